@@ -0,0 +1,18 @@
+# Turns a SPIR-V binary into a comma separated list of 32-bit words that can
+# be #included into a uint32_t array initializer.
+#
+#   cmake -DINPUT=shader.spv -DOUTPUT=shader.spv.inc -P embed_spirv.cmake
+
+file(READ ${INPUT} HEX HEX)
+string(LENGTH "${HEX}" HEX_LENGTH)
+math(EXPR REMAINDER "${HEX_LENGTH} % 8")
+if(HEX_LENGTH GREATER_EQUAL 8)
+  string(SUBSTRING "${HEX}" 0 8 MAGIC)
+endif()
+if(NOT REMAINDER EQUAL 0 OR NOT MAGIC STREQUAL "03022307")
+  message(FATAL_ERROR "${INPUT} is not a SPIR-V binary")
+endif()
+
+# SPIR-V is stored little-endian, so each word's bytes are reversed.
+string(REGEX REPLACE "(..)(..)(..)(..)" "0x\\4\\3\\2\\1,\n" WORDS "${HEX}")
+file(WRITE ${OUTPUT} "${WORDS}")
@@ -1,2 +1,4 @@
 glslc shaders/simple_shader.vert -o shaders/simple_shader.vert.spv
 glslc shaders/simple_shader.frag -o shaders/simple_shader.frag.spv
+glslc shaders/depth_prepass.vert -o shaders/depth_prepass.vert.spv
+glslc shaders/transform.comp -o shaders/transform.comp.spv
@@ -0,0 +1,25 @@
+#version 450
+
+layout(location = 0) in vec3 position;
+
+layout(set = 0, binding = 0) uniform GlobalUbo {
+    mat4 projectionView;
+} ubo;
+
+struct ObjectData {
+    mat4 modelMatrix;
+    mat4 normalMatrix;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+// Must match simple_shader.vert bit for bit so the main pass can test EQUAL.
+invariant gl_Position;
+
+void main() {
+    // Each object is drawn as one instance whose firstInstance is its index.
+    ObjectData object = objectBuffer.objects[gl_InstanceIndex];
+    gl_Position = ubo.projectionView * object.modelMatrix * vec4(position, 1.0);
+}
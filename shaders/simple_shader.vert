@@ -7,19 +7,44 @@ layout(location = 3) in vec3 uv;
 
 layout(location = 0) out vec3 fragColor;
 
-layout(push_constant) uniform Push {
-    mat4 transform;
+layout(set = 0, binding = 0) uniform GlobalUbo {
+    mat4 projectionView;
+} ubo;
+
+struct ObjectData {
+    mat4 modelMatrix;
     mat4 normalMatrix;
-} push;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffer;
+
+// Specialized per pipeline (see SimpleRenderSystem::Lighting), so the
+// lighting branches are resolved when the pipeline is compiled.
+layout(constant_id = 0) const uint LIGHTING_MODEL = 1;
+layout(constant_id = 1) const float DIRECTION_TO_LIGHT_X = 0.30151134;
+layout(constant_id = 2) const float DIRECTION_TO_LIGHT_Y = -0.90453403;
+layout(constant_id = 3) const float DIRECTION_TO_LIGHT_Z = -0.30151134;
+layout(constant_id = 4) const float AMBIENT = 0.1;
 
-const vec3 DIRECTION_TO_LIGHT = normalize(vec3(1.0, -3.0, -1.0));
-const float AMBIENT = 0.1;
+const uint LIGHTING_UNLIT = 0;
+
+invariant gl_Position;
 
 void main() {
-    gl_Position = push.transform * vec4(position, 1.0);
+    // Each object is drawn as one instance whose firstInstance is its index.
+    ObjectData object = objectBuffer.objects[gl_InstanceIndex];
+    gl_Position = ubo.projectionView * object.modelMatrix * vec4(position, 1.0);
+
+    if (LIGHTING_MODEL == LIGHTING_UNLIT) {
+        fragColor = color;
+        return;
+    }
 
-    vec3 normalWorldSpace = normalize(mat3(push.normalMatrix) * normal);
-    float lightIntensity = AMBIENT + max(dot(normalWorldSpace, DIRECTION_TO_LIGHT), 0);
+    const vec3 directionToLight = vec3(DIRECTION_TO_LIGHT_X, DIRECTION_TO_LIGHT_Y, DIRECTION_TO_LIGHT_Z);
+    vec3 normalWorldSpace = normalize(mat3(object.normalMatrix) * normal);
+    float lightIntensity = AMBIENT + max(dot(normalWorldSpace, directionToLight), 0);
 
     fragColor = lightIntensity * color;
 }
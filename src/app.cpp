@@ -1,11 +1,21 @@
 #include "app.hpp"
+#include "buffer.hpp"
 #include "camera.hpp"
+#include "frame_info.hpp"
 #include "gameobject.hpp"
+#include "gpu_transforms.hpp"
 #include "keyboard_movement_controller.hpp"
+#include "pipeline_registry.hpp"
 #include "simple_render_system.hpp"
+#include "simulation.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <iostream>
 #include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -17,28 +27,181 @@
 
 namespace engine {
 
-App::App(SwapChain::PresentMode presentMode) : presentMode(presentMode) {
+// True only on the frame the key goes down.
+static bool wasKeyPressed(GLFWwindow *window, int key, bool &keyDown) {
+  bool pressed = glfwGetKey(window, key) == GLFW_PRESS;
+  bool wasPressed = pressed && !keyDown;
+  keyDown = pressed;
+  return wasPressed;
+}
+
+App::App(const Config &config) : config(config) {
+  if (window) {
+    renderer = std::make_unique<Renderer>(
+        *window, device, config.presentMode, config.framesInFlight);
+  } else {
+    VkExtent2D extent{static_cast<uint32_t>(WIDTH),
+                      static_cast<uint32_t>(HEIGHT)};
+    renderer =
+        std::make_unique<Renderer>(device, extent, config.framesInFlight);
+  }
+
+  if (config.fpsLimit > 0.f) {
+    frameLimiter = std::make_unique<FrameLimiter>(config.fpsLimit);
+  }
+
+  if (config.capture) {
+    if (!(renderer->getBackbufferUsage() &
+          VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+      throw std::runtime_error("Failed to enable capture: the swap chain "
+                               "images can't be copied from");
+    }
+    // Two spare buffers beyond the frames in flight give the encoder a
+    // couple of frames of slack before captures start to drop.
+    frameCapture = std::make_unique<FrameCapture>(
+        device, config.captureFormat, config.capturePath,
+        config.framesInFlight + 2);
+  }
+
+  if (config.dynamicResolution) {
+    VkFormat format = renderer->getSwapChainImageFormat();
+    if (!(renderer->getBackbufferUsage() & VK_IMAGE_USAGE_TRANSFER_DST_BIT) ||
+        !device.isFormatSupported(format, VK_IMAGE_TILING_OPTIMAL,
+                                  VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                      VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+      throw std::runtime_error("Failed to enable dynamic resolution: the "
+                               "backbuffer can't be blitted to");
+    }
+    if (!device.isFormatSupported(
+            format, VK_IMAGE_TILING_OPTIMAL,
+            VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+      upscaleFilter = VK_FILTER_NEAREST;
+    }
+    resolutionScaler = std::make_unique<ResolutionScaler>(config.resolution);
+  }
+
+  manualPresentMode = config.presentMode;
+  if (config.adaptivePresentMode) {
+    setAdaptivePresentMode(true);
+  }
+
+  globalPool = DescriptorPool::Builder(device)
+                   .setMaxSets(config.framesInFlight)
+                   .addPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                config.framesInFlight)
+                   .build();
   loadGameObjects();
 }
 
 App::~App() {}
 
 void App::run() {
-  SimpleRenderSystem simpleRenderSystem{device,
-                                        renderer.getSwapChainRenderPass()};
+  std::vector<std::unique_ptr<Buffer>> uboBuffers(config.framesInFlight);
+  for (auto &uboBuffer : uboBuffers) {
+    uboBuffer = std::make_unique<Buffer>(
+        device, sizeof(GlobalUbo), 1, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    uboBuffer->map();
+  }
+
+  auto globalSetLayout = DescriptorSetLayout::Builder(device)
+                             .addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+                                         VK_SHADER_STAGE_VERTEX_BIT)
+                             .build();
+
+  std::vector<VkDescriptorSet> globalDescriptorSets(config.framesInFlight);
+  for (size_t i = 0; i < globalDescriptorSets.size(); i++) {
+    auto bufferInfo = uboBuffers[i]->descriptorInfo();
+    DescriptorWriter(*globalSetLayout, *globalPool)
+        .writeBuffer(0, &bufferInfo)
+        .build(globalDescriptorSets[i]);
+  }
+
+  // Declared first so the pipelines outlive the render systems using them.
+  PipelineRegistry pipelineRegistry{device, config.shaderOverrideDir};
+  SimpleRenderSystem simpleRenderSystem{
+      device, pipelineRegistry, renderer->getRenderTargetLayout(),
+      globalSetLayout->getDescriptorSetLayout(), config.framesInFlight};
+  pipelineRegistry.releaseShaderModules();
+
+  std::unique_ptr<GpuTransforms> gpuTransforms;
+  if (config.gpuTransforms) {
+    gpuTransforms = std::make_unique<GpuTransforms>(
+        device, std::max(scene.size(), 1u), config.framesInFlight);
+    simpleRenderSystem.useObjectBuffer(gpuTransforms->getObjectBufferInfo());
+  }
+  std::cout << "Created " << device.getPipelinesCreated() << " pipelines for "
+            << pipelineRegistry.getStats().requests << " requests in "
+            << device.getPipelineCreationMs() << " ms ("
+            << (device.isPipelineCacheWarm() ? "warm" : "cold") << " cache)"
+            << std::endl;
   Camera camera{};
 
   auto viewerObject = GameObject::create();
   KeyboardMovementController cameraController{};
 
+  std::unique_ptr<Simulation> simulation;
+  if (config.pipelined) {
+    simulation =
+        std::make_unique<Simulation>(viewerObject.transform, cameraController);
+  }
+  float simulationMs = 0.f;
+  uint32_t matricesRecomputed = 0;
+  Bvh::QueryStats cullingStats{};
+  // Dense indices of the entities to draw this frame.
+  std::vector<uint32_t> visibleEntities;
+
   auto currentTime = std::chrono::high_resolution_clock::now();
+  const auto startTime = currentTime;
+  uint32_t renderedFrames = 0;
 
   int fpsSamples = 60;
   float fpsSum = 0.0f;
   int frameCount = 0;
+  // Resize storms show up as spikes that an average hides.
+  float worstFrameTime = 0.0f;
+  bool depthPrepassKeyDown = false;
+  bool presentModeKeyDown = false;
+  bool adaptivePresentKeyDown = false;
+  bool lightingKeyDown = false;
 
-  while (!window.shouldClose()) {
-    glfwPollEvents();
+  while (window ? !window->shouldClose()
+                : renderedFrames < config.frameCount) {
+    if (config.lowLatency) {
+      renderer->waitForFrameSlot();
+    }
+    if (frameLimiter) {
+      frameLimiter->wait();
+    }
+
+    if (window) {
+      glfwPollEvents();
+      renderer->markInputSampled();
+
+      auto *glfwWindow = window->getGLFWwindow();
+      if (wasKeyPressed(glfwWindow, DEPTH_PREPASS_TOGGLE_KEY,
+                        depthPrepassKeyDown)) {
+        renderer->setDepthPrepassEnabled(
+            !renderer->isDepthPrepassRequested());
+      }
+      if (wasKeyPressed(glfwWindow, PRESENT_MODE_CYCLE_KEY,
+                        presentModeKeyDown)) {
+        cyclePresentMode();
+      }
+      if (wasKeyPressed(glfwWindow, ADAPTIVE_PRESENT_TOGGLE_KEY,
+                        adaptivePresentKeyDown)) {
+        setAdaptivePresentMode(!presentModePolicy);
+      }
+      if (wasKeyPressed(glfwWindow, LIGHTING_TOGGLE_KEY, lightingKeyDown)) {
+        using LightingModel = SimpleRenderSystem::LightingModel;
+        auto lighting = simpleRenderSystem.getLighting();
+        lighting.model = lighting.model == LightingModel::Unlit
+                             ? LightingModel::Lambert
+                             : LightingModel::Unlit;
+        simpleRenderSystem.setLighting(lighting);
+      }
+    }
 
     auto newTime = std::chrono::high_resolution_clock::now();
     float frameTime =
@@ -47,63 +210,382 @@ void App::run() {
             .count();
     currentTime = newTime;
 
-    cameraController.moveInPlaneXZ(window.getGLFWwindow(), frameTime,
-                                   viewerObject);
+    if (simulation) {
+      // Input is sampled here, since GLFW only allows it on the main
+      // thread, and applied by the simulation step for the next frame.
+      if (window) {
+        simulation->publishInput(
+            cameraController.sampleInput(window->getGLFWwindow()));
+      }
+      const auto &snapshot = simulation->acquireSnapshot();
+      viewerObject.transform = snapshot.viewer;
+      simulationMs = snapshot.stepTimeMs;
+    } else if (window) {
+      cameraController.moveInPlaneXZ(window->getGLFWwindow(), frameTime,
+                                     viewerObject);
+    }
     camera.setViewYXZ(viewerObject.transform.translation,
                       viewerObject.transform.rotation);
 
-    float aspect = renderer.getAspectRatio();
+    float aspect = renderer->getAspectRatio();
     camera.setPerspectiveProjection(glm::radians(50.f), aspect, 0.1f, 10.f);
 
-    if (auto commandBuffer = renderer.beginFrame()) {
-      renderer.beginSwapChainRenderPass(commandBuffer);
-      simpleRenderSystem.renderGameObjects(commandBuffer, gameObjects, camera);
-      renderer.endSwapChainRenderPass(commandBuffer);
-      renderer.endFrame();
+    if (auto commandBuffer = renderer->beginFrame()) {
+      if (frameCapture) {
+        frameCapture->collect();
+      }
+
+      int frameIndex = renderer->getFrameIndex();
+      simpleRenderSystem.update();
+      // Frames skip the pre-pass until its pipelines have compiled.
+      bool depthPrepass = renderer->isDepthPrepassEnabled() &&
+                          simpleRenderSystem.prepareDepthPrepass();
+      FrameInfo frameInfo{frameIndex, frameTime, camera,
+                          globalDescriptorSets[frameIndex], depthPrepass};
+
+      GlobalUbo ubo{};
+      ubo.projectionView = camera.getProjection() * camera.getView();
+      uboBuffers[frameIndex]->writeToBuffer(&ubo);
+
+      auto &renderGraph = renderer->getRenderGraph();
+      auto backbuffer = renderer->getBackbuffer();
+      const VkExtent2D outputExtent = renderer->getSwapChainExtent();
+
+      if (!gpuTransforms) {
+        // Static entities keep their matrices; only the ones whose transform
+        // changed are recomputed and copied to this frame's object buffer.
+        matricesRecomputed = scene.updateMatrices(&sceneThreads);
+        simpleRenderSystem.uploadObjectData(frameIndex, scene);
+        if (renderedFrames % BVH_CHECK_INTERVAL == 0) {
+          scene.getBvh().rebuildIfDegraded();
+        }
+        cullingStats = cullScene(ubo.projectionView, visibleEntities);
+      } else {
+        // Without CPU matrices there are no bounds to cull with.
+        if (visibleEntities.size() != scene.size()) {
+          visibleEntities.resize(scene.size());
+          std::iota(visibleEntities.begin(), visibleEntities.end(), 0u);
+        }
+        if (gpuTransforms->update(scene, frameIndex)) {
+          simpleRenderSystem.useObjectBuffer(
+              gpuTransforms->getObjectBufferInfo());
+        }
+        renderGraph.addPass(
+            "Transforms",
+            [](RenderGraph::PassBuilder &builder) {
+              // Writes a buffer, which the graph doesn't track.
+              builder.hasSideEffects();
+            },
+            [&](VkCommandBuffer commandBuffer,
+                const RenderGraph::PassContext &) {
+              gpuTransforms->record(commandBuffer, frameIndex);
+            });
+      }
+
+      // With dynamic resolution the scene goes to a scaled image in the
+      // backbuffer format, which the Upscale pass blits to the backbuffer.
+      auto sceneColor = backbuffer;
+      VkExtent2D sceneExtent = outputExtent;
+      if (resolutionScaler) {
+        sceneExtent = resolutionScaler->scaleExtent(outputExtent);
+        sceneColor = renderGraph.createImage(
+            "scene color",
+            {renderer->getSwapChainImageFormat(), sceneExtent});
+      }
+      auto depth = renderGraph.createImage(
+          "depth", {renderer->getSwapChainDepthFormat(), sceneExtent});
+
+      // Both passes declare the scene color and depth in the same order as
+      // the swap chain render pass, so the pipelines stay compatible.
+      if (frameInfo.depthPrepass) {
+        renderGraph.addPass(
+            "Depth Pre-pass",
+            [&](RenderGraph::PassBuilder &builder) {
+              builder.colorAttachment(sceneColor,
+                                      RenderGraph::LoadOp::DontCare);
+              builder.depthAttachment(depth, RenderGraph::LoadOp::Clear);
+              builder.useSecondaryCommandBuffers();
+            },
+            [&](VkCommandBuffer commandBuffer,
+                const RenderGraph::PassContext &context) {
+              renderer->executeSecondaryCommands(
+                  commandBuffer, context, visibleEntities.size(),
+                  [&](VkCommandBuffer secondary, size_t first, size_t last) {
+                    simpleRenderSystem.renderDepthPrepass(
+                        secondary, frameInfo, scene, visibleEntities,
+                        static_cast<uint32_t>(first),
+                        static_cast<uint32_t>(last));
+                  });
+            });
+      }
+
+      renderGraph.addPass(
+          "Main",
+          [&](RenderGraph::PassBuilder &builder) {
+            builder.colorAttachment(sceneColor, RenderGraph::LoadOp::Clear,
+                                    CLEAR_COLOR);
+            if (frameInfo.depthPrepass) {
+              builder.depthAttachment(depth, RenderGraph::LoadOp::Load,
+                                      false);
+            } else {
+              builder.depthAttachment(depth, RenderGraph::LoadOp::Clear);
+            }
+            builder.useSecondaryCommandBuffers();
+          },
+          [&](VkCommandBuffer commandBuffer,
+              const RenderGraph::PassContext &context) {
+            renderer->executeSecondaryCommands(
+                commandBuffer, context, visibleEntities.size(),
+                [&](VkCommandBuffer secondary, size_t first, size_t last) {
+                  simpleRenderSystem.renderGameObjects(
+                      secondary, frameInfo, scene, visibleEntities,
+                      static_cast<uint32_t>(first),
+                      static_cast<uint32_t>(last));
+                });
+          });
+      if (resolutionScaler) {
+        renderGraph.addPass(
+            "Upscale",
+            [&](RenderGraph::PassBuilder &builder) {
+              builder.transferSource(sceneColor);
+              builder.transferDestination(backbuffer);
+            },
+            [&](VkCommandBuffer commandBuffer,
+                const RenderGraph::PassContext &) {
+              VkImageBlit blit{};
+              blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+              blit.srcSubresource.layerCount = 1;
+              blit.srcOffsets[1] = {static_cast<int32_t>(sceneExtent.width),
+                                    static_cast<int32_t>(sceneExtent.height),
+                                    1};
+              blit.dstSubresource = blit.srcSubresource;
+              blit.dstOffsets[1] = {static_cast<int32_t>(outputExtent.width),
+                                    static_cast<int32_t>(outputExtent.height),
+                                    1};
+              vkCmdBlitImage(commandBuffer, renderGraph.getImage(sceneColor),
+                             VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                             renderGraph.getImage(backbuffer),
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                             upscaleFilter);
+            });
+      }
+
+      if (frameCapture) {
+        frameCapture->capture(renderGraph, backbuffer,
+                              renderer->getFrameValue());
+      }
+      renderGraph.markOutput(backbuffer);
+
+      renderer->endFrame();
+      renderedFrames++;
+
+      float gpuMs = 0.f;
+      for (const auto &timing : renderer->getPassTimings()) {
+        gpuMs += timing.gpuMs;
+      }
+
+      if (presentModePolicy) {
+        renderer->setPresentMode(presentModePolicy->update(
+            std::max(renderer->getRecordTimeMs(), gpuMs)));
+      }
+
+      if (resolutionScaler && !renderer->getPassTimings().empty()) {
+        if (resolutionScaler->update(gpuMs)) {
+          auto scaled = resolutionScaler->scaleExtent(outputExtent);
+          std::cout << "Resolution scale " << resolutionScaler->getScale()
+                    << " (" << scaled.width << "x" << scaled.height
+                    << ") for a " << config.resolution.targetGpuMs
+                    << " ms GPU target" << std::endl;
+        }
+      }
     }
 
     float fps = 1.0f / frameTime;
     fpsSum += fps;
     frameCount++;
+    worstFrameTime = std::max(worstFrameTime, frameTime);
 
     if (frameCount >= fpsSamples) {
       float averageFps = fpsSum / fpsSamples;
 
       std::string windowTitle =
           "Average FPS: " + std::to_string(averageFps) +
-          " | Frame Time: " + std::to_string(frameTime * 1000.0f) + " ms";
-      glfwSetWindowTitle(window.getGLFWwindow(), windowTitle.c_str());
+          " | Frame Time: " + std::to_string(frameTime * 1000.0f) + " ms" +
+          " | Worst: " + std::to_string(worstFrameTime * 1000.0f) + " ms";
+      const auto &latency = renderer->getLatencyStats();
+      if (window) {
+        windowTitle += " | Input->Submit: " +
+                       std::to_string(latency.inputToSubmitMs) + " ms";
+      }
+      if (device.supportsPresentWait()) {
+        windowTitle += " | Submit->Present: " +
+                       std::to_string(latency.submitToPresentMs) + " ms";
+      }
+      if (window) {
+        windowTitle += " | Present: ";
+        windowTitle += SwapChain::presentModeName(renderer->getPresentMode());
+        if (presentModePolicy) {
+          windowTitle += " (adaptive)";
+        }
+        const auto &swapChainStats = renderer->getSwapChainStats();
+        windowTitle += " | Swap chain recreations: " +
+                       std::to_string(swapChainStats.recreations) + " (last " +
+                       std::to_string(swapChainStats.lastRecreateMs) + " ms)";
+      }
+      if (simulation) {
+        windowTitle += " | Sim: " + std::to_string(simulationMs) +
+                       " ms | Record: " +
+                       std::to_string(renderer->getRecordTimeMs()) + " ms";
+      }
+      auto pipelineStats = pipelineRegistry.getStats();
+      windowTitle += " | Pipelines: " + std::to_string(pipelineStats.compiled) +
+                     " (" + std::to_string(pipelineStats.pending) +
+                     " compiling, " + std::to_string(pipelineStats.failed) +
+                     " failed, " + std::to_string(pipelineStats.hitches) +
+                     " hitches, max compile " +
+                     std::to_string(pipelineStats.maxCompileLatencyMs) + " ms)";
+      if (gpuTransforms) {
+        windowTitle += " | Transform uploads: " +
+                       std::to_string(gpuTransforms->getUploadCount());
+      } else {
+        windowTitle += " | Matrices: " + std::to_string(matricesRecomputed) +
+                       " | Uploaded: " +
+                       std::to_string(simpleRenderSystem.getUploadedBytes()) +
+                       " B";
+        auto bvhQuality = scene.getBvh().getQuality();
+        windowTitle += " | Visible: " + std::to_string(cullingStats.results) +
+                       "/" + std::to_string(scene.size()) + " (" +
+                       std::to_string(cullingStats.ms) + " ms) | BVH: " +
+                       std::to_string(bvhQuality.height) + " levels, cost " +
+                       std::to_string(bvhQuality.costRatio) + "x";
+      }
+      if (resolutionScaler) {
+        windowTitle +=
+            " | Scale: " + std::to_string(resolutionScaler->getScale());
+      }
+      for (const auto &timing : renderer->getPassTimings()) {
+        windowTitle += " | GPU " + timing.name + ": " +
+                       std::to_string(timing.gpuMs) + " ms";
+      }
+      if (window) {
+        glfwSetWindowTitle(window->getGLFWwindow(), windowTitle.c_str());
+      } else {
+        std::cout << windowTitle << std::endl;
+      }
 
       fpsSum = 0.0f;
       frameCount = 0;
+      worstFrameTime = 0.0f;
 
       fpsSamples = static_cast<int>(averageFps);
     }
   }
 
   vkDeviceWaitIdle(device.device());
+
+  if (frameCapture) {
+    frameCapture->finish();
+    std::cout << "Captured " << frameCapture->getCapturedCount()
+              << " frames, dropped " << frameCapture->getDroppedCount()
+              << std::endl;
+  }
+
+  if (!window) {
+    float elapsed = std::chrono::duration<float, std::chrono::seconds::period>(
+                        std::chrono::high_resolution_clock::now() - startTime)
+                        .count();
+    std::cout << "Rendered " << renderedFrames << " frames in " << elapsed
+              << " s (" << renderedFrames / elapsed << " FPS)" << std::endl;
+  }
 }
 
-void App::loadGameObjects() {
-  std::shared_ptr<Model> smoothVaseModel =
-      Model::createFromFile(device, "../models/smooth_vase.obj");
+void App::setAdaptivePresentMode(bool enabled) {
+  if (!enabled) {
+    presentModePolicy = nullptr;
+    renderer->setPresentMode(manualPresentMode);
+    std::cout << "Adaptive present mode off" << std::endl;
+    return;
+  }
+  if (!window) {
+    return;
+  }
+
+  // FIFO_RELAXED only tears the frames that are late; MAILBOX never blocks
+  // but renders frames that are never shown.
+  SwapChain::PresentMode lateMode;
+  if (renderer->isPresentModeSupported(SwapChain::FIFO_RELAXED)) {
+    lateMode = SwapChain::FIFO_RELAXED;
+  } else if (renderer->isPresentModeSupported(SwapChain::MAILBOX)) {
+    lateMode = SwapChain::MAILBOX;
+  } else {
+    std::cerr << "Adaptive present mode needs FIFO_RELAXED or MAILBOX"
+              << std::endl;
+    return;
+  }
+
+  float budgetMs = 1000.f / static_cast<float>(window->getRefreshRate());
+  presentModePolicy = std::make_unique<PresentModePolicy>(budgetMs, lateMode);
+  renderer->setPresentMode(presentModePolicy->getPresentMode());
+  std::cout << "Adaptive present mode on, " << budgetMs << " ms budget, "
+            << SwapChain::presentModeName(lateMode) << " when late"
+            << std::endl;
+}
 
-  auto smoothVaseObj = GameObject::create();
-  smoothVaseObj.model = smoothVaseModel;
-  smoothVaseObj.transform.translation = {-0.5f, 0.5f, 2.5f};
-  smoothVaseObj.transform.scale = glm::vec3(3.f);
+// Steps through the supported modes; turns the adaptive policy off.
+void App::cyclePresentMode() {
+  constexpr SwapChain::PresentMode modes[] = {
+      SwapChain::FIFO, SwapChain::FIFO_RELAXED, SwapChain::MAILBOX,
+      SwapChain::IMMEDIATE};
+  constexpr size_t modeCount = sizeof(modes) / sizeof(modes[0]);
 
-  gameObjects.push_back(std::move(smoothVaseObj));
+  size_t current = 0;
+  while (current < modeCount && modes[current] != manualPresentMode) {
+    current++;
+  }
+  for (size_t i = 1; i <= modeCount; i++) {
+    auto mode = modes[(current + i) % modeCount];
+    if (renderer->isPresentModeSupported(mode)) {
+      manualPresentMode = mode;
+      break;
+    }
+  }
+
+  if (presentModePolicy) {
+    setAdaptivePresentMode(false);
+  } else {
+    renderer->setPresentMode(manualPresentMode);
+  }
+}
+
+// Fills visible with the entities whose bounds are at least partly inside
+// the view frustum, touching only the tree nodes the query visits.
+Bvh::QueryStats App::cullScene(const glm::mat4 &projectionView,
+                               std::vector<uint32_t> &visible) {
+  visible.clear();
+  auto stats = scene.getBvh().queryFrustum(
+      Frustum::fromMatrix(projectionView),
+      [&visible](uint32_t index) { visible.push_back(index); });
+  // Back in scene order, where entities sharing a model are adjacent.
+  std::sort(visible.begin(), visible.end());
+  return stats;
+}
+
+void App::loadGameObjects() {
+  auto smoothVaseModel = scene.addModel(
+      Model::createFromFile(device, "../models/smooth_vase.obj"));
 
-  std::shared_ptr<Model> flatVaseModel =
-      Model::createFromFile(device, "../models/flat_vase.obj");
+  TransformComponent smoothVaseTransform{};
+  smoothVaseTransform.translation = {-0.5f, 0.5f, 2.5f};
+  smoothVaseTransform.scale = glm::vec3(3.f);
+  scene.createEntity(smoothVaseModel, smoothVaseTransform);
 
-  auto flatVaseObj = GameObject::create();
-  flatVaseObj.model = flatVaseModel;
-  flatVaseObj.transform.translation = {0.5f, 0.5f, 2.5f};
-  flatVaseObj.transform.scale = glm::vec3(3.f);
+  auto flatVaseModel = scene.addModel(
+      Model::createFromFile(device, "../models/flat_vase.obj"));
 
-  gameObjects.push_back(std::move(flatVaseObj));
+  TransformComponent flatVaseTransform{};
+  flatVaseTransform.translation = {0.5f, 0.5f, 2.5f};
+  flatVaseTransform.scale = glm::vec3(3.f);
+  scene.createEntity(flatVaseModel, flatVaseTransform);
 }
 
 } // namespace engine
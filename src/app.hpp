@@ -1,11 +1,19 @@
 #pragma once
 
+#include "descriptors.hpp"
 #include "device.hpp"
-#include "gameobject.hpp"
+#include "frame_capture.hpp"
+#include "frame_limiter.hpp"
+#include "present_mode_policy.hpp"
 #include "renderer.hpp"
+#include "resolution_scaler.hpp"
+#include "scene.hpp"
 #include "swapchain.hpp"
+#include "thread_pool.hpp"
 #include "window.hpp"
 
+#include <memory>
+#include <string>
 #include <vector>
 
 #include <vulkan/vulkan_core.h>
@@ -16,8 +24,51 @@ class App {
 public:
   static constexpr int WIDTH = 800;
   static constexpr int HEIGHT = 600;
+  static constexpr int DEPTH_PREPASS_TOGGLE_KEY = GLFW_KEY_P;
+  static constexpr int PRESENT_MODE_CYCLE_KEY = GLFW_KEY_F5;
+  static constexpr int ADAPTIVE_PRESENT_TOGGLE_KEY = GLFW_KEY_F6;
+  static constexpr int LIGHTING_TOGGLE_KEY = GLFW_KEY_L;
+  // Frames between checks whether the scene's Bvh needs a rebuild.
+  static constexpr uint32_t BVH_CHECK_INTERVAL = 120;
+  static constexpr VkClearColorValue CLEAR_COLOR{{0.01f, 0.01f, 0.01f, 1.f}};
 
-  App(SwapChain::PresentMode presentMode);
+  struct Config {
+    SwapChain::PresentMode presentMode = SwapChain::FIFO;
+    // Uses VK_KHR_dynamic_rendering instead of render pass and framebuffer
+    // objects when the device supports it.
+    bool dynamicRendering = true;
+    // Overrides presentMode with FIFO while on budget and a tearing mode
+    // while frames run late.
+    bool adaptivePresentMode = false;
+    uint32_t framesInFlight = 2;
+    // Wait for the frame slot before sampling input instead of after.
+    bool lowLatency = false;
+    // Zero disables the limiter.
+    float fpsLimit = 0.f;
+    // Renders offscreen without a window or vsync, for frameCount frames.
+    bool headless = false;
+    uint32_t frameCount = 600;
+    // Writes every rendered frame to capturePath when set.
+    bool capture = false;
+    FrameCapture::Format captureFormat = FrameCapture::Format::PPM;
+    std::string capturePath;
+    // Renders the scene at a scaled resolution driven by GPU frame time
+    // and upscales it to the backbuffer.
+    bool dynamicResolution = false;
+    ResolutionScaler::Settings resolution{};
+    // Runs the simulation step for the next frame on its own thread while
+    // the current frame is recorded.
+    bool pipelined = false;
+    // Where the pipeline cache persists between runs; empty disables it.
+    std::string pipelineCachePath = "pipeline_cache.bin";
+    // Computes object matrices in a compute pass, uploading only the
+    // transforms that changed.
+    bool gpuTransforms = false;
+    // Loads <name>.spv from here instead of the embedded shaders when set.
+    std::string shaderOverrideDir;
+  };
+
+  App(const Config &config);
   ~App();
 
   App(const App &) = delete;
@@ -27,13 +78,33 @@ public:
 
 private:
   void loadGameObjects();
+  Bvh::QueryStats cullScene(const glm::mat4 &projectionView,
+                            std::vector<uint32_t> &visible);
+  void setAdaptivePresentMode(bool enabled);
+  void cyclePresentMode();
 
-  SwapChain::PresentMode presentMode;
-  Window window{WIDTH, HEIGHT, "Hello, Vulkan"};
-  Device device{window};
-  Renderer renderer{window, device, presentMode};
+  Config config;
+  // Null when headless.
+  std::unique_ptr<Window> window{
+      config.headless ? nullptr
+                      : std::make_unique<Window>(WIDTH, HEIGHT,
+                                                 "Hello, Vulkan")};
+  Device device{window.get(), config.dynamicRendering,
+                config.pipelineCachePath};
+  std::unique_ptr<Renderer> renderer;
+  std::unique_ptr<FrameLimiter> frameLimiter;
+  std::unique_ptr<FrameCapture> frameCapture;
+  std::unique_ptr<ResolutionScaler> resolutionScaler;
+  std::unique_ptr<PresentModePolicy> presentModePolicy;
+  // The mode chosen on the command line or by hotkey, used whenever the
+  // adaptive policy is off.
+  SwapChain::PresentMode manualPresentMode = SwapChain::FIFO;
+  VkFilter upscaleFilter = VK_FILTER_LINEAR;
 
-  std::vector<GameObject> gameObjects;
+  std::unique_ptr<DescriptorPool> globalPool{};
+  Scene scene;
+  // Only used for hierarchy levels too large for one thread.
+  ThreadPool sceneThreads{ThreadPool::defaultThreadCount()};
 };
 
 } // namespace engine
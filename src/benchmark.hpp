@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+namespace engine {
+
+// Timing helpers for the CPU benchmarks (--bench).
+namespace benchmark {
+
+using Clock = std::chrono::steady_clock;
+
+inline double msSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Seconds per call of fn: runs runs of repeats calls each, keeping the
+// fastest so a run disturbed by other work doesn't count.
+template <typename Fn> double bestOf(int runs, uint64_t repeats, Fn &&fn) {
+  double best = std::numeric_limits<double>::max();
+  for (int run = 0; run < runs; run++) {
+    auto start = Clock::now();
+    for (uint64_t r = 0; r < repeats; r++) {
+      fn();
+    }
+    best = std::min(best, msSince(start) / 1000.);
+  }
+  return best / static_cast<double>(repeats);
+}
+
+// Stores value where the compiler has to assume it is read, so the work
+// computing it isn't optimized out.
+template <typename T> void keep(T value) {
+  static volatile T sink;
+  sink = value;
+}
+
+} // namespace benchmark
+
+} // namespace engine
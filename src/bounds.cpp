@@ -0,0 +1,37 @@
+#include "bounds.hpp"
+
+namespace engine {
+
+// The new box is centered on the transformed center, and its half size along
+// each axis is what the rotated and scaled half sizes span along it.
+Aabb Aabb::transformed(const glm::mat4 &matrix) const {
+  if (isEmpty()) {
+    return *this;
+  }
+
+  glm::vec3 center = glm::vec3{matrix * glm::vec4{this->center(), 1.f}};
+  glm::vec3 halfSize = size() * 0.5f;
+  glm::vec3 newHalfSize = glm::abs(glm::vec3{matrix[0]}) * halfSize.x +
+                          glm::abs(glm::vec3{matrix[1]}) * halfSize.y +
+                          glm::abs(glm::vec3{matrix[2]}) * halfSize.z;
+  return {center - newHalfSize, center + newHalfSize};
+}
+
+// Gribb and Hartmann: each plane is the sum or difference of the w row and
+// another row of the matrix. Near is z >= 0 alone for 0 to 1 depth.
+Frustum Frustum::fromMatrix(const glm::mat4 &projectionView) {
+  auto row = [&](int i) {
+    return glm::vec4{projectionView[0][i], projectionView[1][i],
+                     projectionView[2][i], projectionView[3][i]};
+  };
+
+  Frustum frustum{};
+  frustum.planes = {row(3) + row(0), row(3) - row(0), row(3) + row(1),
+                    row(3) - row(1), row(2),          row(3) - row(2)};
+  for (auto &plane : frustum.planes) {
+    plane /= glm::length(glm::vec3{plane});
+  }
+  return frustum;
+}
+
+} // namespace engine
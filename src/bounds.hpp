@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <limits>
+
+#include <glm/glm.hpp>
+
+namespace engine {
+
+// Axis-aligned bounding box. Default constructed it is empty, and expanding
+// it by anything gives that thing's bounds.
+struct Aabb {
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+  bool isEmpty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+  glm::vec3 center() const { return (min + max) * 0.5f; }
+  glm::vec3 size() const { return max - min; }
+  float surfaceArea() const {
+    glm::vec3 s = size();
+    return 2.f * (s.x * s.y + s.y * s.z + s.z * s.x);
+  }
+
+  void expand(const glm::vec3 &point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+  }
+  void expand(const Aabb &other) {
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+  }
+  bool contains(const Aabb &other) const {
+    return glm::all(glm::lessThanEqual(min, other.min)) &&
+           glm::all(glm::greaterThanEqual(max, other.max));
+  }
+
+  // Bounds of this box after an affine transform.
+  Aabb transformed(const glm::mat4 &matrix) const;
+
+  static Aabb merge(const Aabb &a, const Aabb &b) {
+    return {glm::min(a.min, b.min), glm::max(a.max, b.max)};
+  }
+};
+
+struct Ray {
+  glm::vec3 origin{};
+  // Need not be normalized; distances are in multiples of it.
+  glm::vec3 direction{0.f, 0.f, 1.f};
+};
+
+struct Sphere {
+  glm::vec3 center{};
+  float radius = 0.f;
+
+  bool overlaps(const Aabb &box) const {
+    glm::vec3 closest = glm::clamp(center, box.min, box.max);
+    glm::vec3 offset = closest - center;
+    return glm::dot(offset, offset) <= radius * radius;
+  }
+};
+
+// The six planes of a view frustum, normals pointing inwards (xyz) with
+// their distance from the origin (w).
+struct Frustum {
+  enum class Containment { Outside, Intersects, Inside };
+
+  // Planes of a projection * view matrix with Vulkan's 0 to 1 depth range.
+  static Frustum fromMatrix(const glm::mat4 &projectionView);
+
+  Containment classify(const Aabb &box) const {
+    Containment containment = Containment::Inside;
+    for (const auto &plane : planes) {
+      glm::vec3 normal{plane};
+      // The corners furthest along and against the normal.
+      glm::bvec3 alongNormal = glm::greaterThanEqual(normal, glm::vec3{0.f});
+      glm::vec3 positive = glm::mix(box.min, box.max, alongNormal);
+      glm::vec3 negative = glm::mix(box.max, box.min, alongNormal);
+      if (glm::dot(normal, positive) + plane.w < 0.f) {
+        return Containment::Outside;
+      }
+      if (glm::dot(normal, negative) + plane.w < 0.f) {
+        containment = Containment::Intersects;
+      }
+    }
+    return containment;
+  }
+
+  std::array<glm::vec4, 6> planes;
+};
+
+} // namespace engine
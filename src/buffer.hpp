@@ -0,0 +1,58 @@
+#pragma once
+
+#include "device.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+class Buffer {
+public:
+  Buffer(Device &device, VkDeviceSize instanceSize, uint32_t instanceCount,
+         VkBufferUsageFlags usageFlags,
+         VkMemoryPropertyFlags memoryPropertyFlags,
+         VkDeviceSize minOffsetAlignment = 1);
+  ~Buffer();
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  VkResult map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
+  void unmap();
+
+  void writeToBuffer(const void *data, VkDeviceSize size = VK_WHOLE_SIZE,
+                     VkDeviceSize offset = 0);
+  VkResult flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
+  // Makes device writes visible to the host for non-coherent memory.
+  VkResult invalidate(VkDeviceSize size = VK_WHOLE_SIZE,
+                      VkDeviceSize offset = 0);
+  VkDescriptorBufferInfo descriptorInfo(VkDeviceSize size = VK_WHOLE_SIZE,
+                                        VkDeviceSize offset = 0);
+
+  void writeToIndex(const void *data, uint32_t index);
+  VkResult flushIndex(uint32_t index);
+  VkDescriptorBufferInfo descriptorInfoForIndex(uint32_t index);
+
+  VkBuffer getBuffer() const { return buffer; }
+  void *getMappedMemory() const { return mapped; }
+  uint32_t getInstanceCount() const { return instanceCount; }
+  VkDeviceSize getInstanceSize() const { return instanceSize; }
+  VkDeviceSize getAlignmentSize() const { return alignmentSize; }
+  VkDeviceSize getBufferSize() const { return bufferSize; }
+
+private:
+  static VkDeviceSize getAlignment(VkDeviceSize instanceSize,
+                                   VkDeviceSize minOffsetAlignment);
+
+  Device &device;
+  void *mapped = nullptr;
+  VkBuffer buffer = VK_NULL_HANDLE;
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+
+  VkDeviceSize bufferSize;
+  uint32_t instanceCount;
+  VkDeviceSize instanceSize;
+  VkDeviceSize alignmentSize;
+};
+
+} // namespace engine
@@ -0,0 +1,465 @@
+#include "bvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <limits>
+#include <utility>
+
+namespace engine {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+float elapsedMs(Clock::time_point start) {
+  return std::chrono::duration<float, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// Distance along the ray to where it enters box, or a negative value if it
+// misses it within maxDistance.
+float rayEntry(const Aabb &box, const glm::vec3 &origin,
+               const glm::vec3 &inverseDirection, float maxDistance) {
+  glm::vec3 t1 = (box.min - origin) * inverseDirection;
+  glm::vec3 t2 = (box.max - origin) * inverseDirection;
+  glm::vec3 near = glm::min(t1, t2);
+  glm::vec3 far = glm::max(t1, t2);
+  float entry = std::max({near.x, near.y, near.z, 0.f});
+  float exit = std::min({far.x, far.y, far.z, maxDistance});
+  return entry <= exit ? entry : -1.f;
+}
+
+} // namespace
+
+Bvh::ProxyId Bvh::insert(const Aabb &bounds, uint32_t userData) {
+  ProxyId leaf = allocateNode();
+  glm::vec3 margin = bounds.size() * FAT_MARGIN;
+  nodes[leaf].bounds = {bounds.min - margin, bounds.max + margin};
+  nodes[leaf].userData = userData;
+  insertLeaf(leaf);
+  leafCount++;
+  return leaf;
+}
+
+void Bvh::remove(ProxyId proxy) {
+  assert(nodes[proxy].isLeaf() && "Not a proxy");
+  removeLeaf(proxy);
+  freeNode(proxy);
+  leafCount--;
+}
+
+bool Bvh::update(ProxyId proxy, const Aabb &bounds) {
+  assert(nodes[proxy].isLeaf() && "Not a proxy");
+  if (nodes[proxy].bounds.contains(bounds)) {
+    return false;
+  }
+
+  // Reinserting rather than growing the box in place finds the leaf a
+  // sibling near where it is now, so fast movers don't stretch the nodes
+  // they started in.
+  removeLeaf(proxy);
+  glm::vec3 margin = bounds.size() * FAT_MARGIN;
+  nodes[proxy].bounds = {bounds.min - margin, bounds.max + margin};
+  insertLeaf(proxy);
+  return true;
+}
+
+void Bvh::rebuild() {
+  if (root == NULL_PROXY) {
+    rebuiltCost = 0.f;
+    return;
+  }
+
+  // Keep the leaves, they are the proxy ids handed out, and free the rest.
+  std::vector<ProxyId> leaves;
+  leaves.reserve(leafCount);
+  std::vector<ProxyId> stack{root};
+  while (!stack.empty()) {
+    ProxyId node = stack.back();
+    stack.pop_back();
+    if (nodes[node].isLeaf()) {
+      leaves.push_back(node);
+    } else {
+      stack.push_back(nodes[node].left);
+      stack.push_back(nodes[node].right);
+      freeNode(node);
+    }
+  }
+
+  root = buildSah(leaves.data(), static_cast<uint32_t>(leaves.size()));
+  nodes[root].parent = NULL_PROXY;
+  rebuiltCost = getQuality().sahCost;
+}
+
+bool Bvh::rebuildIfDegraded(float maxCostRatio) {
+  if (getQuality().costRatio <= maxCostRatio) {
+    return false;
+  }
+  rebuild();
+  return true;
+}
+
+Bvh::QueryStats Bvh::queryFrustum(const Frustum &frustum,
+                                  const QueryFn &fn) const {
+  auto start = Clock::now();
+  QueryStats stats{};
+
+  std::vector<ProxyId> stack;
+  if (root != NULL_PROXY) {
+    stack.push_back(root);
+  }
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    ProxyId index = stack.back();
+    stack.pop_back();
+    stats.nodesVisited++;
+
+    switch (frustum.classify(node.bounds)) {
+    case Frustum::Containment::Outside:
+      break;
+    case Frustum::Containment::Inside:
+      // Everything below is inside too, no need to test it.
+      reportSubtree(index, fn, stats);
+      break;
+    case Frustum::Containment::Intersects:
+      if (node.isLeaf()) {
+        fn(node.userData);
+        stats.results++;
+      } else {
+        stack.push_back(node.left);
+        stack.push_back(node.right);
+      }
+      break;
+    }
+  }
+
+  stats.ms = elapsedMs(start);
+  return stats;
+}
+
+Bvh::QueryStats Bvh::querySphere(const Sphere &sphere,
+                                 const QueryFn &fn) const {
+  auto start = Clock::now();
+  QueryStats stats{};
+
+  std::vector<ProxyId> stack;
+  if (root != NULL_PROXY) {
+    stack.push_back(root);
+  }
+  while (!stack.empty()) {
+    const Node &node = nodes[stack.back()];
+    stack.pop_back();
+    stats.nodesVisited++;
+
+    if (!sphere.overlaps(node.bounds)) {
+      continue;
+    }
+    if (node.isLeaf()) {
+      fn(node.userData);
+      stats.results++;
+    } else {
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+    }
+  }
+
+  stats.ms = elapsedMs(start);
+  return stats;
+}
+
+Bvh::QueryStats Bvh::raycast(const Ray &ray, float maxDistance,
+                             const RayFn &fn) const {
+  auto start = Clock::now();
+  QueryStats stats{};
+  const glm::vec3 inverseDirection = 1.f / ray.direction;
+
+  // Nodes with the distance at which the ray enters them, so ones behind a
+  // hit found since they were pushed can be dropped.
+  std::vector<std::pair<ProxyId, float>> stack;
+  if (root != NULL_PROXY) {
+    float entry =
+        rayEntry(nodes[root].bounds, ray.origin, inverseDirection, maxDistance);
+    if (entry >= 0.f) {
+      stack.emplace_back(root, entry);
+    }
+  }
+  while (!stack.empty()) {
+    auto [index, entry] = stack.back();
+    stack.pop_back();
+    if (entry > maxDistance) {
+      continue;
+    }
+    const Node &node = nodes[index];
+    stats.nodesVisited++;
+
+    if (node.isLeaf()) {
+      stats.results++;
+      maxDistance = std::min(maxDistance, fn(node.userData, entry));
+      continue;
+    }
+
+    float leftEntry = rayEntry(nodes[node.left].bounds, ray.origin,
+                               inverseDirection, maxDistance);
+    float rightEntry = rayEntry(nodes[node.right].bounds, ray.origin,
+                                inverseDirection, maxDistance);
+    std::pair<ProxyId, float> nearer{node.left, leftEntry};
+    std::pair<ProxyId, float> farther{node.right, rightEntry};
+    if (farther.second >= 0.f &&
+        (nearer.second < 0.f || farther.second < nearer.second)) {
+      std::swap(nearer, farther);
+    }
+    // Pushed last so it is visited first.
+    if (farther.second >= 0.f) {
+      stack.push_back(farther);
+    }
+    if (nearer.second >= 0.f) {
+      stack.push_back(nearer);
+    }
+  }
+
+  stats.ms = elapsedMs(start);
+  return stats;
+}
+
+Bvh::Quality Bvh::getQuality() const {
+  Quality quality{};
+  if (root == NULL_PROXY) {
+    return quality;
+  }
+
+  float totalArea = 0.f;
+  std::vector<std::pair<ProxyId, uint32_t>> stack{{root, 1}};
+  while (!stack.empty()) {
+    auto [index, depth] = stack.back();
+    stack.pop_back();
+    const Node &node = nodes[index];
+
+    quality.nodes++;
+    quality.height = std::max(quality.height, depth);
+    totalArea += node.bounds.surfaceArea();
+    if (node.isLeaf()) {
+      quality.leaves++;
+    } else {
+      stack.emplace_back(node.left, depth + 1);
+      stack.emplace_back(node.right, depth + 1);
+    }
+  }
+
+  float rootArea = nodes[root].bounds.surfaceArea();
+  quality.sahCost = rootArea > 0.f ? totalArea / rootArea : 0.f;
+  if (rebuiltCost > 0.f) {
+    quality.costRatio = quality.sahCost / rebuiltCost;
+  }
+  return quality;
+}
+
+Bvh::ProxyId Bvh::allocateNode() {
+  if (freeList == NULL_PROXY) {
+    nodes.emplace_back();
+    return static_cast<ProxyId>(nodes.size() - 1);
+  }
+
+  ProxyId node = freeList;
+  freeList = nodes[node].parent;
+  nodes[node] = Node{};
+  return node;
+}
+
+void Bvh::freeNode(ProxyId node) {
+  nodes[node].parent = freeList;
+  freeList = node;
+}
+
+// Walks down to the sibling where a new parent costs the least extra
+// surface area, counting the growth of every ancestor on the way.
+void Bvh::insertLeaf(ProxyId leaf) {
+  if (root == NULL_PROXY) {
+    root = leaf;
+    nodes[leaf].parent = NULL_PROXY;
+    return;
+  }
+
+  const Aabb bounds = nodes[leaf].bounds;
+  ProxyId sibling = root;
+  while (!nodes[sibling].isLeaf()) {
+    const Node &node = nodes[sibling];
+    float area = node.bounds.surfaceArea();
+    float combinedArea = Aabb::merge(node.bounds, bounds).surfaceArea();
+
+    // A new parent of this node and the leaf.
+    float cost = 2.f * combinedArea;
+    // Every parent below grows this node by as much.
+    float inheritedCost = 2.f * (combinedArea - area);
+
+    auto descendCost = [&](ProxyId child) {
+      const Aabb &childBounds = nodes[child].bounds;
+      float grown = Aabb::merge(childBounds, bounds).surfaceArea();
+      if (nodes[child].isLeaf()) {
+        return grown + inheritedCost;
+      }
+      return grown - childBounds.surfaceArea() + inheritedCost;
+    };
+    float leftCost = descendCost(node.left);
+    float rightCost = descendCost(node.right);
+
+    if (cost < leftCost && cost < rightCost) {
+      break;
+    }
+    sibling = leftCost < rightCost ? node.left : node.right;
+  }
+
+  ProxyId oldParent = nodes[sibling].parent;
+  ProxyId newParent = allocateNode();
+  nodes[newParent].parent = oldParent;
+  nodes[newParent].bounds = Aabb::merge(bounds, nodes[sibling].bounds);
+  nodes[newParent].left = sibling;
+  nodes[newParent].right = leaf;
+  nodes[sibling].parent = newParent;
+  nodes[leaf].parent = newParent;
+
+  if (oldParent == NULL_PROXY) {
+    root = newParent;
+    return;
+  }
+  if (nodes[oldParent].left == sibling) {
+    nodes[oldParent].left = newParent;
+  } else {
+    nodes[oldParent].right = newParent;
+  }
+  refitAncestors(oldParent);
+}
+
+// The leaf's sibling takes its parent's place.
+void Bvh::removeLeaf(ProxyId leaf) {
+  if (leaf == root) {
+    root = NULL_PROXY;
+    return;
+  }
+
+  ProxyId parent = nodes[leaf].parent;
+  ProxyId grandParent = nodes[parent].parent;
+  ProxyId sibling =
+      nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+  freeNode(parent);
+
+  nodes[sibling].parent = grandParent;
+  if (grandParent == NULL_PROXY) {
+    root = sibling;
+    return;
+  }
+  if (nodes[grandParent].left == parent) {
+    nodes[grandParent].left = sibling;
+  } else {
+    nodes[grandParent].right = sibling;
+  }
+  refitAncestors(grandParent);
+}
+
+void Bvh::refitAncestors(ProxyId node) {
+  for (; node != NULL_PROXY; node = nodes[node].parent) {
+    nodes[node].bounds = Aabb::merge(nodes[nodes[node].left].bounds,
+                                     nodes[nodes[node].right].bounds);
+  }
+}
+
+// Splits the leaves along the axis their centers spread most on, at the
+// bin boundary with the lowest area * count on both sides. Returns the
+// subtree root; the caller sets its parent.
+Bvh::ProxyId Bvh::buildSah(ProxyId *leaves, uint32_t count) {
+  if (count == 1) {
+    return leaves[0];
+  }
+
+  Aabb bounds{};
+  Aabb centers{};
+  for (uint32_t i = 0; i < count; i++) {
+    bounds.expand(nodes[leaves[i]].bounds);
+    centers.expand(nodes[leaves[i]].bounds.center());
+  }
+
+  glm::vec3 spread = centers.size();
+  int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2)
+                                 : (spread.y > spread.z ? 1 : 2);
+  uint32_t leftCount = count / 2;
+
+  if (spread[axis] > 0.f) {
+    auto binOf = [&](ProxyId leaf) {
+      float offset = nodes[leaf].bounds.center()[axis] - centers.min[axis];
+      auto bin = static_cast<uint32_t>(offset / spread[axis] * SAH_BINS);
+      return std::min(bin, SAH_BINS - 1);
+    };
+
+    std::array<Aabb, SAH_BINS> binBounds{};
+    std::array<uint32_t, SAH_BINS> binCounts{};
+    for (uint32_t i = 0; i < count; i++) {
+      uint32_t bin = binOf(leaves[i]);
+      binBounds[bin].expand(nodes[leaves[i]].bounds);
+      binCounts[bin]++;
+    }
+
+    // Cost of splitting after bin i, from sweeps in both directions.
+    std::array<float, SAH_BINS - 1> costs{};
+    Aabb sweep{};
+    uint32_t sweepCount = 0;
+    for (uint32_t i = 0; i < SAH_BINS - 1; i++) {
+      sweep.expand(binBounds[i]);
+      sweepCount += binCounts[i];
+      costs[i] = sweepCount > 0 ? sweep.surfaceArea() * sweepCount : 0.f;
+    }
+    sweep = Aabb{};
+    sweepCount = 0;
+    for (uint32_t i = SAH_BINS - 1; i > 0; i--) {
+      sweep.expand(binBounds[i]);
+      sweepCount += binCounts[i];
+      costs[i - 1] += sweepCount > 0 ? sweep.surfaceArea() * sweepCount : 0.f;
+    }
+
+    uint32_t split = static_cast<uint32_t>(
+        std::min_element(costs.begin(), costs.end()) - costs.begin());
+    ProxyId *middle = std::partition(
+        leaves, leaves + count,
+        [&](ProxyId leaf) { return binOf(leaf) <= split; });
+    leftCount = static_cast<uint32_t>(middle - leaves);
+  }
+
+  // Centers all in one bin or one spot: split by count instead.
+  if (leftCount == 0 || leftCount == count) {
+    leftCount = count / 2;
+    std::nth_element(leaves, leaves + leftCount, leaves + count,
+                     [&](ProxyId a, ProxyId b) {
+                       return nodes[a].bounds.center()[axis] <
+                              nodes[b].bounds.center()[axis];
+                     });
+  }
+
+  ProxyId left = buildSah(leaves, leftCount);
+  ProxyId right = buildSah(leaves + leftCount, count - leftCount);
+  ProxyId node = allocateNode();
+  nodes[node].left = left;
+  nodes[node].right = right;
+  nodes[node].bounds = bounds;
+  nodes[left].parent = node;
+  nodes[right].parent = node;
+  return node;
+}
+
+void Bvh::reportSubtree(ProxyId node, const QueryFn &fn,
+                        QueryStats &stats) const {
+  std::vector<ProxyId> stack{node};
+  while (!stack.empty()) {
+    const Node &current = nodes[stack.back()];
+    stack.pop_back();
+    if (current.isLeaf()) {
+      fn(current.userData);
+      stats.results++;
+    } else {
+      stats.nodesVisited += 2;
+      stack.push_back(current.left);
+      stack.push_back(current.right);
+    }
+  }
+}
+
+} // namespace engine
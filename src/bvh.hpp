@@ -0,0 +1,112 @@
+#pragma once
+
+#include "bounds.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace engine {
+
+// Dynamic bounding volume hierarchy over boxes, for frustum, ray and sphere
+// queries that skip whole subtrees instead of testing every box.
+//
+// Leaves keep a box grown by FAT_MARGIN, so objects moving a little don't
+// touch the tree. insert(), remove() and update() cost O(depth): inserts
+// walk down to the sibling that adds the least surface area, and updates
+// that leave the fattened box remove the leaf and insert it again. Greedy
+// inserts still let the tree degrade over time; rebuild() builds it from
+// scratch with a binned surface area heuristic (SAH), and
+// rebuildIfDegraded() does so once the SAH cost has grown enough since the
+// last rebuild.
+class Bvh {
+public:
+  using ProxyId = int32_t;
+  using QueryFn = std::function<void(uint32_t userData)>;
+  // Returns the new maximum distance, e.g. the distance of an exact hit
+  // against the object, or maxDistance to keep going.
+  using RayFn = std::function<float(uint32_t userData, float distance)>;
+
+  static constexpr ProxyId NULL_PROXY = -1;
+  // Of the box's size, on each side.
+  static constexpr float FAT_MARGIN = 0.1f;
+  static constexpr uint32_t SAH_BINS = 16;
+
+  struct Quality {
+    uint32_t leaves = 0;
+    uint32_t nodes = 0;
+    uint32_t height = 0;
+    // Surface area of every node relative to the root's: how many boxes a
+    // random ray through the root is expected to test.
+    float sahCost = 0.f;
+    // sahCost relative to right after the last rebuild.
+    float costRatio = 1.f;
+  };
+
+  struct QueryStats {
+    uint32_t nodesVisited = 0;
+    uint32_t results = 0;
+    float ms = 0.f;
+  };
+
+  Bvh() = default;
+
+  Bvh(const Bvh &) = delete;
+  Bvh &operator=(const Bvh &) = delete;
+
+  ProxyId insert(const Aabb &bounds, uint32_t userData);
+  void remove(ProxyId proxy);
+  // Returns false if bounds still fit the leaf's fattened box and nothing
+  // changed.
+  bool update(ProxyId proxy, const Aabb &bounds);
+  void setUserData(ProxyId proxy, uint32_t userData) {
+    nodes[proxy].userData = userData;
+  }
+  uint32_t getUserData(ProxyId proxy) const { return nodes[proxy].userData; }
+  const Aabb &getFatBounds(ProxyId proxy) const { return nodes[proxy].bounds; }
+
+  void rebuild();
+  // Walks the whole tree to measure it, so call it every so often rather
+  // than every frame.
+  bool rebuildIfDegraded(float maxCostRatio = 1.5f);
+
+  // Calls fn for every leaf whose fattened box is at least partly inside.
+  QueryStats queryFrustum(const Frustum &frustum, const QueryFn &fn) const;
+  QueryStats querySphere(const Sphere &sphere, const QueryFn &fn) const;
+  // Calls fn for leaves the ray enters within maxDistance, nearest subtree
+  // first, skipping subtrees beyond the distance fn last returned.
+  QueryStats raycast(const Ray &ray, float maxDistance,
+                     const RayFn &fn) const;
+
+  uint32_t getLeafCount() const { return leafCount; }
+  Quality getQuality() const;
+
+private:
+  struct Node {
+    Aabb bounds;
+    // The next free node while on the free list.
+    ProxyId parent = NULL_PROXY;
+    ProxyId left = NULL_PROXY;
+    ProxyId right = NULL_PROXY;
+    uint32_t userData = 0;
+
+    bool isLeaf() const { return left == NULL_PROXY; }
+  };
+
+  ProxyId allocateNode();
+  void freeNode(ProxyId node);
+  void insertLeaf(ProxyId leaf);
+  void removeLeaf(ProxyId leaf);
+  void refitAncestors(ProxyId node);
+  ProxyId buildSah(ProxyId *leaves, uint32_t count);
+  void reportSubtree(ProxyId node, const QueryFn &fn,
+                     QueryStats &stats) const;
+
+  std::vector<Node> nodes;
+  ProxyId root = NULL_PROXY;
+  ProxyId freeList = NULL_PROXY;
+  uint32_t leafCount = 0;
+  float rebuiltCost = 0.f;
+};
+
+} // namespace engine
@@ -0,0 +1,196 @@
+#include "bvh_benchmark.hpp"
+#include "benchmark.hpp"
+#include "bounds.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+namespace engine {
+
+namespace {
+
+using benchmark::Clock;
+using benchmark::msSince;
+
+// Boxes are spread so that density is the same at every count.
+constexpr float BOXES_PER_UNIT3 = 0.05f;
+constexpr int MOVE_FRAMES = 60;
+constexpr float DT = 1.f / 60.f;
+constexpr float MAX_SPEED = 4.f;
+constexpr int FRUSTUM_QUERIES = 100;
+constexpr int RAY_QUERIES = 1000;
+constexpr int SPHERE_QUERIES = 1000;
+constexpr float VIEW_DISTANCE = 100.f;
+constexpr float SPHERE_RADIUS = 10.f;
+
+struct QueryCosts {
+  // Microseconds and nodes visited per query.
+  double frustumUs = 0., raycastUs = 0., sphereUs = 0.;
+  double frustumNodes = 0., raycastNodes = 0., sphereNodes = 0.;
+};
+
+// The same queries are run on both trees.
+struct Queries {
+  std::vector<Frustum> frustums;
+  std::vector<Ray> rays;
+  std::vector<Sphere> spheres;
+};
+
+glm::vec3 randomDirection(std::mt19937 &random) {
+  std::normal_distribution<float> normal;
+  glm::vec3 direction{normal(random), normal(random), normal(random)};
+  return glm::normalize(direction);
+}
+
+Queries makeQueries(std::mt19937 &random, float extent) {
+  std::uniform_real_distribution<float> position{0.f, extent};
+  auto randomPosition = [&] {
+    return glm::vec3{position(random), position(random), position(random)};
+  };
+
+  Queries queries;
+  Camera camera;
+  camera.setPerspectiveProjection(glm::radians(50.f), 16.f / 9.f, 0.1f,
+                                  VIEW_DISTANCE);
+  for (int i = 0; i < FRUSTUM_QUERIES; i++) {
+    camera.setViewDirection(randomPosition(), randomDirection(random));
+    queries.frustums.push_back(
+        Frustum::fromMatrix(camera.getProjection() * camera.getView()));
+  }
+  for (int i = 0; i < RAY_QUERIES; i++) {
+    queries.rays.push_back({randomPosition(), randomDirection(random)});
+  }
+  for (int i = 0; i < SPHERE_QUERIES; i++) {
+    queries.spheres.push_back({randomPosition(), SPHERE_RADIUS});
+  }
+  return queries;
+}
+
+QueryCosts measureQueries(const Bvh &bvh, const Queries &queries) {
+  QueryCosts costs;
+  uint32_t results = 0;
+  auto count = [&results](uint32_t) { results++; };
+
+  auto start = Clock::now();
+  for (const auto &frustum : queries.frustums) {
+    costs.frustumNodes += bvh.queryFrustum(frustum, count).nodesVisited;
+  }
+  costs.frustumUs = msSince(start) * 1000. / queries.frustums.size();
+  costs.frustumNodes /= queries.frustums.size();
+
+  // Nearest hit, taking the distance to the box as the distance to the
+  // object.
+  start = Clock::now();
+  for (const auto &ray : queries.rays) {
+    costs.raycastNodes +=
+        bvh.raycast(ray, VIEW_DISTANCE, [&results](uint32_t, float distance) {
+             results++;
+             return distance;
+           }).nodesVisited;
+  }
+  costs.raycastUs = msSince(start) * 1000. / queries.rays.size();
+  costs.raycastNodes /= queries.rays.size();
+
+  start = Clock::now();
+  for (const auto &sphere : queries.spheres) {
+    costs.sphereNodes += bvh.querySphere(sphere, count).nodesVisited;
+  }
+  costs.sphereUs = msSince(start) * 1000. / queries.spheres.size();
+  costs.sphereNodes /= queries.spheres.size();
+
+  benchmark::keep(results);
+  return costs;
+}
+
+void printTree(const char *name, const Bvh::Quality &quality,
+               const QueryCosts &costs) {
+  std::cout << "  " << name << ": height " << quality.height << ", SAH cost "
+            << quality.sahCost << " | frustum " << costs.frustumUs << " us ("
+            << costs.frustumNodes << " nodes) | ray " << costs.raycastUs
+            << " us (" << costs.raycastNodes << " nodes) | sphere "
+            << costs.sphereUs << " us (" << costs.sphereNodes << " nodes)"
+            << std::endl;
+}
+
+void benchmarkCount(uint32_t count) {
+  std::mt19937 random{count};
+  const float extent = std::cbrt(count / BOXES_PER_UNIT3);
+  std::uniform_real_distribution<float> position{0.f, extent};
+  std::uniform_real_distribution<float> halfSize{0.25f, 1.f};
+  std::uniform_real_distribution<float> speed{0.f, MAX_SPEED};
+
+  std::vector<glm::vec3> centers(count);
+  std::vector<glm::vec3> halfSizes(count);
+  std::vector<glm::vec3> velocities(count);
+  for (uint32_t i = 0; i < count; i++) {
+    centers[i] = {position(random), position(random), position(random)};
+    halfSizes[i] = glm::vec3{halfSize(random)};
+    velocities[i] = randomDirection(random) * speed(random);
+  }
+  auto boundsOf = [&](uint32_t i) {
+    return Aabb{centers[i] - halfSizes[i], centers[i] + halfSizes[i]};
+  };
+
+  Bvh bvh;
+  std::vector<Bvh::ProxyId> proxies(count);
+  auto start = Clock::now();
+  for (uint32_t i = 0; i < count; i++) {
+    proxies[i] = bvh.insert(boundsOf(i), i);
+  }
+  double insertMs = msSince(start);
+
+  start = Clock::now();
+  bvh.rebuild();
+  double initialRebuildMs = msSince(start);
+
+  // Objects scatter in every direction, so the tree built for their
+  // starting positions fits worse and worse.
+  double updateMs = 0.;
+  uint32_t moved = 0;
+  for (int frame = 0; frame < MOVE_FRAMES; frame++) {
+    start = Clock::now();
+    for (uint32_t i = 0; i < count; i++) {
+      centers[i] += velocities[i] * DT;
+      moved += bvh.update(proxies[i], boundsOf(i));
+    }
+    updateMs += msSince(start);
+  }
+
+  Queries queries = makeQueries(random, extent);
+  QueryCosts updated = measureQueries(bvh, queries);
+  Bvh::Quality updatedQuality = bvh.getQuality();
+
+  start = Clock::now();
+  bvh.rebuild();
+  double rebuildMs = msSince(start);
+  QueryCosts rebuilt = measureQueries(bvh, queries);
+
+  std::cout << std::fixed << std::setprecision(2) << count
+            << " boxes | insert " << insertMs << " ms | rebuild "
+            << initialRebuildMs << " ms | update "
+            << updateMs / MOVE_FRAMES << " ms/frame ("
+            << moved / MOVE_FRAMES << " reinserted/frame) | rebuild after "
+            << MOVE_FRAMES << " frames " << rebuildMs << " ms" << std::endl;
+  printTree("updated", updatedQuality, updated);
+  printTree("rebuilt", bvh.getQuality(), rebuilt);
+}
+
+} // namespace
+
+void runBvhBenchmark() {
+  for (uint32_t count : {10'000u, 100'000u, 1'000'000u}) {
+    benchmarkCount(count);
+  }
+}
+
+} // namespace engine
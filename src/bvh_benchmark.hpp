@@ -0,0 +1,11 @@
+#pragma once
+
+namespace engine {
+
+// Builds a Bvh over 10k, 100k and 1M random boxes, moves every box for a
+// number of frames with update() and compares the incrementally updated tree
+// against rebuild(): time taken, tree quality, and the cost of frustum, ray
+// and sphere queries on both trees. Runs on the CPU only.
+void runBvhBenchmark();
+
+} // namespace engine
@@ -1,8 +1,13 @@
 #include "device.hpp"
 
+#include <cassert>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <set>
+#include <stdexcept>
 #include <unordered_set>
 
 #define RESET "\033[0m"
@@ -67,16 +72,27 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance,
   }
 }
 
-Device::Device(Window &window) : window{window} {
+Device::Device(Window *window, bool allowDynamicRendering,
+               const std::string &pipelineCachePath)
+    : window{window}, dynamicRenderingAllowed{allowDynamicRendering},
+      pipelineCachePath{pipelineCachePath} {
   createInstance();
   setupDebugMessenger();
   createSurface();
   pickPhysicalDevice();
   createLogicalDevice();
   createCommandPool();
+  createFrameTimeline();
+  createPipelineCache();
 }
 
 Device::~Device() {
+  vkDeviceWaitIdle(device_);
+  flushDeletionQueue();
+
+  savePipelineCache();
+  vkDestroyPipelineCache(device_, pipelineCache_, nullptr);
+  vkDestroySemaphore(device_, frameTimeline, nullptr);
   vkDestroyCommandPool(device_, commandPool, nullptr);
   vkDestroyDevice(device_, nullptr);
 
@@ -84,7 +100,9 @@ Device::~Device() {
     DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
   }
 
-  vkDestroySurfaceKHR(instance, surface_, nullptr);
+  if (!isHeadless()) {
+    vkDestroySurfaceKHR(instance, surface_, nullptr);
+  }
   vkDestroyInstance(instance, nullptr);
 }
 
@@ -99,7 +117,7 @@ void Device::createInstance() {
   appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
   appInfo.pEngineName = "No Engine";
   appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-  appInfo.apiVersion = VK_API_VERSION_1_0;
+  appInfo.apiVersion = VK_API_VERSION_1_2;
 
   VkInstanceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -158,8 +176,10 @@ void Device::createLogicalDevice() {
   QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
 
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily,
-                                            indices.presentFamily};
+  std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily};
+  if (indices.presentFamilyHasValue) {
+    uniqueQueueFamilies.insert(indices.presentFamily);
+  }
 
   float queuePriority = 1.0f;
   for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -174,17 +194,71 @@ void Device::createLogicalDevice() {
   VkPhysicalDeviceFeatures deviceFeatures = {};
   deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+  vulkan12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  vulkan12Features.timelineSemaphore = VK_TRUE;
+
+  std::vector<const char *> extensions = getRequiredDeviceExtensions();
+
+  // Present wait is optional; it only improves frame pacing.
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+  presentIdFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+  presentWaitFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+  if (!isHeadless() &&
+      isDeviceExtensionAvailable(physicalDevice,
+                                 VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+      isDeviceExtensionAvailable(physicalDevice,
+                                 VK_KHR_PRESENT_WAIT_EXTENSION_NAME)) {
+    presentIdFeatures.pNext = &presentWaitFeatures;
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &presentIdFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+    if (presentIdFeatures.presentId && presentWaitFeatures.presentWait) {
+      extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+      extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+      vulkan12Features.pNext = &presentIdFeatures;
+      presentWaitSupported = true;
+    }
+  }
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {};
+  dynamicRenderingFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+
+  if (dynamicRenderingAllowed &&
+      isDeviceExtensionAvailable(physicalDevice,
+                                 VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &dynamicRenderingFeatures;
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features2);
+
+    if (dynamicRenderingFeatures.dynamicRendering) {
+      extensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+      dynamicRenderingFeatures.pNext = vulkan12Features.pNext;
+      vulkan12Features.pNext = &dynamicRenderingFeatures;
+      dynamicRenderingSupported = true;
+    }
+  }
+
   VkDeviceCreateInfo createInfo = {};
   createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+  createInfo.pNext = &vulkan12Features;
 
   createInfo.queueCreateInfoCount =
       static_cast<uint32_t>(queueCreateInfos.size());
   createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
   createInfo.pEnabledFeatures = &deviceFeatures;
-  createInfo.enabledExtensionCount =
-      static_cast<uint32_t>(deviceExtensions.size());
-  createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+  createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+  createInfo.ppEnabledExtensionNames = extensions.data();
 
   if (enableValidationLayers) {
     createInfo.enabledLayerCount =
@@ -199,8 +273,31 @@ void Device::createLogicalDevice() {
     throw std::runtime_error("failed to create logical device!");
   }
 
+  if (presentWaitSupported) {
+    waitForPresentKHR = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+        vkGetDeviceProcAddr(device_, "vkWaitForPresentKHR"));
+    presentWaitSupported = waitForPresentKHR != nullptr;
+  }
+  std::cout << "present wait: "
+            << (presentWaitSupported ? "supported" : "not supported")
+            << std::endl;
+
+  if (dynamicRenderingSupported) {
+    cmdBeginRenderingKHR = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+        vkGetDeviceProcAddr(device_, "vkCmdBeginRenderingKHR"));
+    cmdEndRenderingKHR = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+        vkGetDeviceProcAddr(device_, "vkCmdEndRenderingKHR"));
+    dynamicRenderingSupported =
+        cmdBeginRenderingKHR != nullptr && cmdEndRenderingKHR != nullptr;
+  }
+  std::cout << "dynamic rendering: "
+            << (dynamicRenderingSupported ? "enabled" : "not enabled")
+            << std::endl;
+
   vkGetDeviceQueue(device_, indices.graphicsFamily, 0, &graphicsQueue_);
-  vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+  if (indices.presentFamilyHasValue) {
+    vkGetDeviceQueue(device_, indices.presentFamily, 0, &presentQueue_);
+  }
 }
 
 void Device::createCommandPool() {
@@ -218,8 +315,203 @@ void Device::createCommandPool() {
   }
 }
 
+void Device::createFrameTimeline() {
+  VkSemaphoreTypeCreateInfo typeInfo = {};
+  typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = {};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphoreInfo.pNext = &typeInfo;
+
+  if (vkCreateSemaphore(device_, &semaphoreInfo, nullptr, &frameTimeline) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create frame timeline semaphore!");
+  }
+}
+
+void Device::createPipelineCache() {
+  std::vector<char> data;
+  if (!pipelineCachePath.empty()) {
+    std::ifstream file{pipelineCachePath, std::ios::ate | std::ios::binary};
+    if (file.is_open()) {
+      data.resize(static_cast<size_t>(file.tellg()));
+      file.seekg(0);
+      file.read(data.data(), data.size());
+      if (!file || !isPipelineCacheCompatible(data)) {
+        std::cout << "pipeline cache: ignoring " << pipelineCachePath
+                  << ", it was written by another device or driver"
+                  << std::endl;
+        data.clear();
+      }
+    }
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo = {};
+  cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheInfo.initialDataSize = data.size();
+  cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+  if (vkCreatePipelineCache(device_, &cacheInfo, nullptr, &pipelineCache_) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create pipeline cache!");
+  }
+
+  pipelineCacheWarm = !data.empty();
+  std::cout << "pipeline cache: "
+            << (pipelineCacheWarm
+                    ? "loaded " + std::to_string(data.size()) + " bytes"
+                    : std::string{"cold"})
+            << std::endl;
+}
+
+// The driver rejects foreign data on its own, but a cache from another
+// device or driver version is useless, so it isn't handed over at all.
+bool Device::isPipelineCacheCompatible(const std::vector<char> &data) {
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+
+  return header.headerSize >= sizeof(header) &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID &&
+         header.deviceID == properties.deviceID &&
+         std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                     VK_UUID_SIZE) == 0;
+}
+
+// Written to a temporary file first and renamed over the old cache, so a
+// crash while saving never leaves a truncated cache behind.
+void Device::savePipelineCache() {
+  if (pipelineCachePath.empty()) {
+    return;
+  }
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(device_, pipelineCache_, &size, nullptr) !=
+      VK_SUCCESS) {
+    return;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device_, pipelineCache_, &size, data.data()) !=
+      VK_SUCCESS) {
+    return;
+  }
+  data.resize(size);
+
+  const std::string tempPath = pipelineCachePath + ".tmp";
+  {
+    std::ofstream file{tempPath, std::ios::binary | std::ios::trunc};
+    file.write(data.data(), data.size());
+    if (!file) {
+      std::cerr << "pipeline cache: failed to write " << tempPath
+                << std::endl;
+      return;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, pipelineCachePath, error);
+  if (error) {
+    std::cerr << "pipeline cache: failed to save " << pipelineCachePath
+              << ": " << error.message() << std::endl;
+    std::filesystem::remove(tempPath, error);
+  }
+}
+
+void Device::recordPipelineCreation(
+    std::chrono::steady_clock::duration duration) {
+  pipelinesCreated++;
+  pipelineCreationNs +=
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+float Device::getPipelineCreationMs() const {
+  return static_cast<float>(pipelineCreationNs.load()) / 1e6f;
+}
+
+void Device::markFrameSubmitted(uint64_t frame) {
+  assert(frame > lastSubmittedFrame_ && "Frame values must increase");
+  lastSubmittedFrame_ = frame;
+}
+
+uint64_t Device::completedFrame() {
+  uint64_t value = 0;
+  if (vkGetSemaphoreCounterValue(device_, frameTimeline, &value) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to query frame timeline semaphore!");
+  }
+  completedFrame_ = value;
+  return value;
+}
+
+bool Device::isFrameComplete(uint64_t frame) {
+  return frame <= completedFrame_ || frame <= completedFrame();
+}
+
+void Device::waitForFrame(uint64_t frame) {
+  if (isFrameComplete(frame)) {
+    return;
+  }
+
+  VkSemaphoreWaitInfo waitInfo = {};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &frameTimeline;
+  waitInfo.pValues = &frame;
+
+  if (vkWaitSemaphores(device_, &waitInfo,
+                       std::numeric_limits<uint64_t>::max()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to wait for frame timeline semaphore!");
+  }
+  completedFrame();
+}
+
+void Device::deferDestroy(std::function<void()> destroy) {
+  std::lock_guard<std::mutex> lock{deletionMutex};
+  deletionQueue.push_back({lastSubmittedFrame_ + 1, std::move(destroy)});
+}
+
+void Device::collectGarbage() {
+  std::vector<std::function<void()>> ready;
+  {
+    std::lock_guard<std::mutex> lock{deletionMutex};
+    while (!deletionQueue.empty() &&
+           isFrameComplete(deletionQueue.front().frame)) {
+      ready.push_back(std::move(deletionQueue.front().destroy));
+      deletionQueue.pop_front();
+    }
+  }
+
+  for (auto &destroy : ready) {
+    destroy();
+  }
+}
+
+void Device::flushDeletionQueue() {
+  // Destroying one object may defer the destruction of others it owns.
+  while (true) {
+    std::deque<DeferredDestroy> pending;
+    {
+      std::lock_guard<std::mutex> lock{deletionMutex};
+      pending.swap(deletionQueue);
+    }
+    if (pending.empty()) {
+      break;
+    }
+    for (auto &entry : pending) {
+      entry.destroy();
+    }
+  }
+}
+
 void Device::createSurface() {
-  window.createWindowSurface(instance, &surface_);
+  if (window != nullptr) {
+    window->createWindowSurface(instance, &surface_);
+  }
 }
 
 bool Device::isDeviceSuitable(VkPhysicalDevice device) {
@@ -227,8 +519,8 @@ bool Device::isDeviceSuitable(VkPhysicalDevice device) {
 
   bool extensionsSupported = checkDeviceExtensionSupport(device);
 
-  bool swapChainAdequate = false;
-  if (extensionsSupported) {
+  bool swapChainAdequate = isHeadless();
+  if (extensionsSupported && !isHeadless()) {
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
     swapChainAdequate = !swapChainSupport.formats.empty() &&
                         !swapChainSupport.presentModes.empty();
@@ -237,8 +529,23 @@ bool Device::isDeviceSuitable(VkPhysicalDevice device) {
   VkPhysicalDeviceFeatures supportedFeatures;
   vkGetPhysicalDeviceFeatures(device, &supportedFeatures);
 
+  VkPhysicalDeviceProperties deviceProperties;
+  vkGetPhysicalDeviceProperties(device, &deviceProperties);
+  if (deviceProperties.apiVersion < VK_API_VERSION_1_2) {
+    return false;
+  }
+
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {};
+  vulkan12Features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  VkPhysicalDeviceFeatures2 features2 = {};
+  features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features2.pNext = &vulkan12Features;
+  vkGetPhysicalDeviceFeatures2(device, &features2);
+
   return indices.isComplete() && extensionsSupported && swapChainAdequate &&
-         supportedFeatures.samplerAnisotropy;
+         supportedFeatures.samplerAnisotropy &&
+         vulkan12Features.timelineSemaphore;
 }
 
 void Device::populateDebugMessengerCreateInfo(
@@ -293,12 +600,14 @@ bool Device::checkValidationLayerSupport() {
 }
 
 std::vector<const char *> Device::getRequiredExtensions() {
-  uint32_t glfwExtensionCount = 0;
-  const char **glfwExtensions;
-  glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+  std::vector<const char *> extensions;
 
-  std::vector<const char *> extensions(glfwExtensions,
-                                       glfwExtensions + glfwExtensionCount);
+  if (!isHeadless()) {
+    uint32_t glfwExtensionCount = 0;
+    const char **glfwExtensions;
+    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+  }
 
   if (enableValidationLayers) {
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -331,6 +640,48 @@ void Device::hasGflwRequiredInstanceExtensions() {
   }
 }
 
+bool Device::isDeviceExtensionAvailable(VkPhysicalDevice device,
+                                        const char *extensionName) {
+  uint32_t extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                       availableExtensions.data());
+
+  for (const auto &extension : availableExtensions) {
+    if (strcmp(extension.extensionName, extensionName) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+VkResult Device::waitForPresent(VkSwapchainKHR swapChain, uint64_t presentId,
+                                uint64_t timeout) {
+  assert(presentWaitSupported && "Present wait is not supported");
+  return waitForPresentKHR(device_, swapChain, presentId, timeout);
+}
+
+void Device::cmdBeginRendering(VkCommandBuffer commandBuffer,
+                               const VkRenderingInfoKHR &renderingInfo) {
+  assert(dynamicRenderingSupported && "Dynamic rendering is not enabled");
+  cmdBeginRenderingKHR(commandBuffer, &renderingInfo);
+}
+
+void Device::cmdEndRendering(VkCommandBuffer commandBuffer) {
+  assert(dynamicRenderingSupported && "Dynamic rendering is not enabled");
+  cmdEndRenderingKHR(commandBuffer);
+}
+
+std::vector<const char *> Device::getRequiredDeviceExtensions() {
+  if (isHeadless()) {
+    return {};
+  }
+  return deviceExtensions;
+}
+
 bool Device::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   uint32_t extensionCount;
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
@@ -340,8 +691,8 @@ bool Device::checkDeviceExtensionSupport(VkPhysicalDevice device) {
   vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
                                        availableExtensions.data());
 
-  std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                           deviceExtensions.end());
+  auto required = getRequiredDeviceExtensions();
+  std::set<std::string> requiredExtensions(required.begin(), required.end());
 
   for (const auto &extension : availableExtensions) {
     requiredExtensions.erase(extension.extensionName);
@@ -352,6 +703,7 @@ bool Device::checkDeviceExtensionSupport(VkPhysicalDevice device) {
 
 QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
   QueueFamilyIndices indices;
+  indices.presentRequired = !isHeadless();
 
   uint32_t queueFamilyCount = 0;
   vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
@@ -368,7 +720,10 @@ QueueFamilyIndices Device::findQueueFamilies(VkPhysicalDevice device) {
       indices.graphicsFamilyHasValue = true;
     }
     VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_, &presentSupport);
+    if (!isHeadless()) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface_,
+                                           &presentSupport);
+    }
     if (queueFamily.queueCount > 0 && presentSupport) {
       indices.presentFamily = i;
       indices.presentFamilyHasValue = true;
@@ -413,20 +768,24 @@ VkFormat Device::findSupportedFormat(const std::vector<VkFormat> &candidates,
                                      VkImageTiling tiling,
                                      VkFormatFeatureFlags features) {
   for (VkFormat format : candidates) {
-    VkFormatProperties props;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
-
-    if (tiling == VK_IMAGE_TILING_LINEAR &&
-        (props.linearTilingFeatures & features) == features) {
-      return format;
-    } else if (tiling == VK_IMAGE_TILING_OPTIMAL &&
-               (props.optimalTilingFeatures & features) == features) {
+    if (isFormatSupported(format, tiling, features)) {
       return format;
     }
   }
   throw std::runtime_error("failed to find supported format!");
 }
 
+bool Device::isFormatSupported(VkFormat format, VkImageTiling tiling,
+                               VkFormatFeatureFlags features) {
+  VkFormatProperties props;
+  vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+  if (tiling == VK_IMAGE_TILING_LINEAR) {
+    return (props.linearTilingFeatures & features) == features;
+  }
+  return (props.optimalTilingFeatures & features) == features;
+}
+
 uint32_t Device::findMemoryType(uint32_t typeFilter,
                                 VkMemoryPropertyFlags properties) {
   VkPhysicalDeviceMemoryProperties memProperties;
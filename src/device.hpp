@@ -2,6 +2,13 @@
 
 #include "window.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <vector>
 
 namespace engine {
@@ -17,7 +24,12 @@ struct QueueFamilyIndices {
   uint32_t presentFamily;
   bool graphicsFamilyHasValue = false;
   bool presentFamilyHasValue = false;
-  bool isComplete() { return graphicsFamilyHasValue && presentFamilyHasValue; }
+  // False for headless devices, which never present.
+  bool presentRequired = true;
+  bool isComplete() {
+    return graphicsFamilyHasValue &&
+           (presentFamilyHasValue || !presentRequired);
+  }
 };
 
 class Device {
@@ -28,7 +40,12 @@ public:
   const bool enableValidationLayers = true;
 #endif
 
-  Device(Window &window);
+  // A null window creates a headless device: no surface, no swap chain
+  // extension and no present queue. Dynamic rendering is enabled when
+  // allowed and supported. The pipeline cache is loaded from and saved to
+  // pipelineCachePath unless it is empty.
+  Device(Window *window, bool allowDynamicRendering = true,
+         const std::string &pipelineCachePath = "");
   ~Device();
 
   Device(const Device &) = delete;
@@ -42,6 +59,45 @@ public:
   VkSurfaceKHR surface() { return surface_; }
   VkQueue graphicsQueue() { return graphicsQueue_; }
   VkQueue presentQueue() { return presentQueue_; }
+  bool isHeadless() const { return window == nullptr; }
+
+  // Frame values are signaled on a single timeline semaphore, one per
+  // submitted frame, starting at 1. Any subsystem can test or wait for a
+  // frame value instead of keeping fences of its own.
+  VkSemaphore frameTimelineSemaphore() { return frameTimeline; }
+  uint64_t lastSubmittedFrame() const { return lastSubmittedFrame_; }
+  void markFrameSubmitted(uint64_t frame);
+  uint64_t completedFrame();
+  bool isFrameComplete(uint64_t frame);
+  void waitForFrame(uint64_t frame);
+
+  // VK_KHR_present_id + VK_KHR_present_wait, enabled when available.
+  bool supportsPresentWait() const { return presentWaitSupported; }
+  VkResult waitForPresent(VkSwapchainKHR swapChain, uint64_t presentId,
+                          uint64_t timeout);
+
+  // VK_KHR_dynamic_rendering: render without VkRenderPass or VkFramebuffer
+  // objects; pipelines are created against attachment formats instead.
+  bool supportsDynamicRendering() const { return dynamicRenderingSupported; }
+  void cmdBeginRendering(VkCommandBuffer commandBuffer,
+                         const VkRenderingInfoKHR &renderingInfo);
+  void cmdEndRendering(VkCommandBuffer commandBuffer);
+
+  // Used for every pipeline. Starts from the cache file when it was written
+  // by the same driver for the same device ("warm"), otherwise empty.
+  VkPipelineCache pipelineCache() { return pipelineCache_; }
+  bool isPipelineCacheWarm() const { return pipelineCacheWarm; }
+  // Pipeline creation time since startup, for comparing cold and warm runs.
+  void recordPipelineCreation(std::chrono::steady_clock::duration duration);
+  uint32_t getPipelinesCreated() const { return pipelinesCreated; }
+  float getPipelineCreationMs() const;
+
+  // Runs destroy once every frame submitted so far, and the frame currently
+  // being recorded, has completed, so no command buffer can still reference
+  // the object. Safe to call from any thread.
+  void deferDestroy(std::function<void()> destroy);
+  // Releases everything whose frame has retired. Called once per frame.
+  void collectGarbage();
 
   SwapChainSupportDetails getSwapChainSupport() {
     return querySwapChainSupport(physicalDevice);
@@ -54,6 +110,8 @@ public:
   VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates,
                                VkImageTiling tiling,
                                VkFormatFeatureFlags features);
+  bool isFormatSupported(VkFormat format, VkImageTiling tiling,
+                         VkFormatFeatureFlags features);
 
   void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
                     VkMemoryPropertyFlags properties, VkBuffer &buffer,
@@ -77,27 +135,62 @@ private:
   void pickPhysicalDevice();
   void createLogicalDevice();
   void createCommandPool();
+  void createFrameTimeline();
+  void createPipelineCache();
+  void savePipelineCache();
+  void flushDeletionQueue();
+
+  bool isPipelineCacheCompatible(const std::vector<char> &data);
 
   bool isDeviceSuitable(VkPhysicalDevice device);
   std::vector<const char *> getRequiredExtensions();
+  std::vector<const char *> getRequiredDeviceExtensions();
   bool checkValidationLayerSupport();
   QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
   void populateDebugMessengerCreateInfo(
       VkDebugUtilsMessengerCreateInfoEXT &createInfo);
   void hasGflwRequiredInstanceExtensions();
   bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+  bool isDeviceExtensionAvailable(VkPhysicalDevice device,
+                                  const char *extensionName);
   SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
 
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-  Window &window;
+  Window *window;
   VkCommandPool commandPool;
 
   VkDevice device_;
-  VkSurfaceKHR surface_;
+  VkSurfaceKHR surface_ = VK_NULL_HANDLE;
   VkQueue graphicsQueue_;
-  VkQueue presentQueue_;
+  VkQueue presentQueue_ = VK_NULL_HANDLE;
+
+  bool presentWaitSupported = false;
+  PFN_vkWaitForPresentKHR waitForPresentKHR = nullptr;
+
+  bool dynamicRenderingAllowed;
+  bool dynamicRenderingSupported = false;
+  PFN_vkCmdBeginRenderingKHR cmdBeginRenderingKHR = nullptr;
+  PFN_vkCmdEndRenderingKHR cmdEndRenderingKHR = nullptr;
+
+  std::string pipelineCachePath;
+  VkPipelineCache pipelineCache_ = VK_NULL_HANDLE;
+  bool pipelineCacheWarm = false;
+  std::atomic<uint32_t> pipelinesCreated{0};
+  std::atomic<int64_t> pipelineCreationNs{0};
+
+  VkSemaphore frameTimeline = VK_NULL_HANDLE;
+  std::atomic<uint64_t> lastSubmittedFrame_{0};
+  std::atomic<uint64_t> completedFrame_{0};
+
+  struct DeferredDestroy {
+    uint64_t frame;
+    std::function<void()> destroy;
+  };
+  // Frame tags are non-decreasing from front to back.
+  std::deque<DeferredDestroy> deletionQueue;
+  std::mutex deletionMutex;
 
   const std::vector<const char *> validationLayers = {
       "VK_LAYER_KHRONOS_validation"};
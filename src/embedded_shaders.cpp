@@ -0,0 +1,43 @@
+#include "embedded_shaders.hpp"
+
+namespace engine {
+
+// The .spv.inc files are generated from shaders/ by the build (see
+// CMakeLists.txt). Add new shaders here as well.
+namespace {
+
+alignas(16) constexpr uint32_t SIMPLE_SHADER_VERT[] = {
+#include "simple_shader.vert.spv.inc"
+};
+
+alignas(16) constexpr uint32_t SIMPLE_SHADER_FRAG[] = {
+#include "simple_shader.frag.spv.inc"
+};
+
+alignas(16) constexpr uint32_t DEPTH_PREPASS_VERT[] = {
+#include "depth_prepass.vert.spv.inc"
+};
+
+alignas(16) constexpr uint32_t TRANSFORM_COMP[] = {
+#include "transform.comp.spv.inc"
+};
+
+constexpr EmbeddedShader SHADERS[] = {
+    {"simple_shader.vert", SIMPLE_SHADER_VERT, sizeof(SIMPLE_SHADER_VERT)},
+    {"simple_shader.frag", SIMPLE_SHADER_FRAG, sizeof(SIMPLE_SHADER_FRAG)},
+    {"depth_prepass.vert", DEPTH_PREPASS_VERT, sizeof(DEPTH_PREPASS_VERT)},
+    {"transform.comp", TRANSFORM_COMP, sizeof(TRANSFORM_COMP)},
+};
+
+} // namespace
+
+const EmbeddedShader *findEmbeddedShader(const std::string &name) {
+  for (const auto &shader : SHADERS) {
+    if (name == shader.name) {
+      return &shader;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace engine
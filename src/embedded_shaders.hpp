@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace engine {
+
+// SPIR-V compiled into the binary at build time, looked up by shader source
+// file name (e.g. "simple_shader.vert").
+struct EmbeddedShader {
+  const char *name;
+  const uint32_t *code;
+  // In bytes, as VkShaderModuleCreateInfo expects.
+  size_t size;
+};
+
+// Null if no shader of that name was embedded.
+const EmbeddedShader *findEmbeddedShader(const std::string &name);
+
+} // namespace engine
@@ -0,0 +1,227 @@
+#include "frame_capture.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+
+namespace engine {
+
+FrameCapture::FrameCapture(Device &device, Format format,
+                           const std::string &path, uint32_t ringSize)
+    : device{device}, format{format}, path{path}, slots(ringSize) {
+  if (format == Format::PPM) {
+    std::filesystem::create_directories(path);
+  } else {
+    videoStream.open(path, std::ios::binary | std::ios::trunc);
+    if (!videoStream) {
+      throw std::runtime_error("Failed to open capture file: " + path);
+    }
+  }
+}
+
+FrameCapture::~FrameCapture() {}
+
+bool FrameCapture::isSupportedFormat(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+    return true;
+  default:
+    return false;
+  }
+}
+
+FrameCapture::Slot *FrameCapture::acquireSlot() {
+  for (size_t i = 0; i < slots.size(); i++) {
+    auto &slot = slots[(nextSlot + i) % slots.size()];
+    if (slot.state == SlotState::Free) {
+      nextSlot = (nextSlot + i + 1) % slots.size();
+      return &slot;
+    }
+  }
+  return nullptr;
+}
+
+// Free slots are referenced by neither the GPU nor the encoder, so their
+// buffer can be replaced right away.
+void FrameCapture::prepareSlot(Slot &slot, VkExtent2D extent) {
+  VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) *
+                      extent.height * 4;
+  if (slot.buffer == nullptr || slot.buffer->getBufferSize() < size) {
+    // Cached memory: the encoder reads every byte, which is slow from
+    // write-combined memory.
+    slot.buffer = std::make_unique<Buffer>(
+        device, size, 1, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    slot.buffer->map();
+  }
+  slot.extent = extent;
+}
+
+void FrameCapture::capture(RenderGraph &graph, RenderGraph::ResourceId image,
+                           uint64_t frameValue) {
+  const auto &desc = graph.getImageDesc(image);
+  if (!isSupportedFormat(desc.format)) {
+    throw std::runtime_error("Unsupported capture image format");
+  }
+
+  if (format == Format::RawVideo) {
+    if (videoExtent.width == 0) {
+      videoExtent = desc.extent;
+    } else if (videoExtent.width != desc.extent.width ||
+               videoExtent.height != desc.extent.height) {
+      droppedCount++;
+      return;
+    }
+  }
+
+  Slot *slot = acquireSlot();
+  if (slot == nullptr) {
+    droppedCount++;
+    return;
+  }
+  prepareSlot(*slot, desc.extent);
+  slot->format = desc.format;
+  slot->frameValue = frameValue;
+  slot->state = SlotState::Copying;
+
+  graph.addPass(
+      "Capture",
+      [&](RenderGraph::PassBuilder &builder) {
+        builder.transferSource(image);
+        builder.hasSideEffects();
+      },
+      [&graph, image, slot](VkCommandBuffer commandBuffer,
+                            const RenderGraph::PassContext &) {
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {slot->extent.width, slot->extent.height, 1};
+        vkCmdCopyImageToBuffer(commandBuffer, graph.getImage(image),
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               slot->buffer->getBuffer(), 1, &region);
+
+        // The timeline signal alone doesn't make the copy visible to the
+        // host.
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = slot->buffer->getBuffer();
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                             &barrier, 0, nullptr);
+      });
+}
+
+void FrameCapture::collect() {
+  rethrowEncoderError();
+
+  std::vector<Slot *> completed;
+  for (auto &slot : slots) {
+    if (slot.state == SlotState::Copying &&
+        device.isFrameComplete(slot.frameValue)) {
+      completed.push_back(&slot);
+    }
+  }
+
+  // The encoder runs tasks in order, so raw video frames stay in order.
+  std::sort(completed.begin(), completed.end(),
+            [](const Slot *a, const Slot *b) {
+              return a->frameValue < b->frameValue;
+            });
+  for (auto *slot : completed) {
+    slot->state = SlotState::Encoding;
+    encoder.submit([this, slot] {
+      try {
+        encode(*slot);
+        capturedCount++;
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{errorMutex};
+        if (!encoderError) {
+          encoderError = std::current_exception();
+        }
+      }
+      slot->state = SlotState::Free;
+    });
+  }
+}
+
+void FrameCapture::finish() {
+  uint64_t lastFrame = 0;
+  for (const auto &slot : slots) {
+    if (slot.state == SlotState::Copying) {
+      lastFrame = std::max(lastFrame, slot.frameValue);
+    }
+  }
+  device.waitForFrame(lastFrame);
+  collect();
+  encoder.wait();
+  rethrowEncoderError();
+
+  if (videoStream.is_open()) {
+    videoStream.flush();
+  }
+}
+
+void FrameCapture::rethrowEncoderError() {
+  std::lock_guard<std::mutex> lock{errorMutex};
+  if (encoderError) {
+    auto error = encoderError;
+    encoderError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void FrameCapture::encode(const Slot &slot) {
+  slot.buffer->invalidate();
+
+  const uint32_t width = slot.extent.width;
+  const uint32_t height = slot.extent.height;
+  const bool bgra = slot.format == VK_FORMAT_B8G8R8A8_UNORM ||
+                    slot.format == VK_FORMAT_B8G8R8A8_SRGB;
+  const auto *pixels =
+      static_cast<const uint8_t *>(slot.buffer->getMappedMemory());
+
+  std::ofstream frameFile;
+  std::ostream *out = &videoStream;
+  if (format == Format::PPM) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "frame_%06llu.ppm",
+                  static_cast<unsigned long long>(slot.frameValue));
+    frameFile.open(std::filesystem::path(path) / name, std::ios::binary);
+    if (!frameFile) {
+      throw std::runtime_error("Failed to open capture file: " +
+                               std::string(name));
+    }
+    frameFile << "P6\n" << width << " " << height << "\n255\n";
+    out = &frameFile;
+  }
+
+  rowBuffer.resize(static_cast<size_t>(width) * 3);
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t *src = pixels + static_cast<size_t>(y) * width * 4;
+    uint8_t *dst = rowBuffer.data();
+    for (uint32_t x = 0; x < width; x++, src += 4, dst += 3) {
+      dst[0] = bgra ? src[2] : src[0];
+      dst[1] = src[1];
+      dst[2] = bgra ? src[0] : src[2];
+    }
+    out->write(reinterpret_cast<const char *>(rowBuffer.data()),
+               static_cast<std::streamsize>(rowBuffer.size()));
+  }
+
+  if (!*out) {
+    throw std::runtime_error("Failed to write captured frame");
+  }
+}
+
+} // namespace engine
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "device.hpp"
+#include "render_graph.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+// Reads rendered frames back without stalling the frame loop. Each capture
+// copies an image into one of a ring of host-visible buffers; once the
+// frame timeline shows the copy has completed, the buffer is handed to a
+// worker thread that converts it to RGB and writes it out. When every
+// buffer is still busy the frame is dropped rather than waited for.
+class FrameCapture {
+public:
+  enum class Format {
+    // One binary PPM per frame in the output directory.
+    PPM,
+    // Tightly packed rgb24 frames appended to a single file, e.g. for
+    // ffmpeg -f rawvideo -pix_fmt rgb24 -video_size WxH.
+    RawVideo
+  };
+
+  FrameCapture(Device &device, Format format, const std::string &path,
+               uint32_t ringSize);
+  ~FrameCapture();
+
+  FrameCapture(const FrameCapture &) = delete;
+  FrameCapture &operator=(const FrameCapture &) = delete;
+
+  // Adds a pass to graph that copies image once frameValue's other passes
+  // have written it. The image must be 8-bit RGBA or BGRA and usable as a
+  // transfer source.
+  void capture(RenderGraph &graph, RenderGraph::ResourceId image,
+               uint64_t frameValue);
+  // Hands finished copies to the encoder. Call once per frame. Rethrows
+  // the first encoder error.
+  void collect();
+  // Waits for every capture in flight to be written. Rethrows the first
+  // encoder error.
+  void finish();
+
+  uint64_t getCapturedCount() const { return capturedCount; }
+  uint64_t getDroppedCount() const { return droppedCount; }
+
+private:
+  enum class SlotState { Free, Copying, Encoding };
+
+  struct Slot {
+    std::unique_ptr<Buffer> buffer;
+    VkExtent2D extent{};
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    uint64_t frameValue = 0;
+    std::atomic<SlotState> state{SlotState::Free};
+  };
+
+  static bool isSupportedFormat(VkFormat format);
+  Slot *acquireSlot();
+  void prepareSlot(Slot &slot, VkExtent2D extent);
+  // Runs on the encoder thread.
+  void encode(const Slot &slot);
+  void rethrowEncoderError();
+
+  Device &device;
+  Format format;
+  std::string path;
+
+  std::vector<Slot> slots;
+  size_t nextSlot = 0;
+  // Raw video can't change resolution midway; the first capture fixes it.
+  VkExtent2D videoExtent{};
+
+  std::atomic<uint64_t> capturedCount{0};
+  uint64_t droppedCount = 0;
+
+  std::mutex errorMutex;
+  std::exception_ptr encoderError;
+
+  // Only touched by the encoder thread.
+  std::ofstream videoStream;
+  std::vector<uint8_t> rowBuffer;
+  // Last, so pending encodes finish before the slots they read go away.
+  ThreadPool encoder{1};
+};
+
+} // namespace engine
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "camera.hpp"
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+// Laid out to match GlobalUbo in the shaders (std140).
+struct GlobalUbo {
+  glm::mat4 projectionView{1.f};
+};
+
+struct FrameInfo {
+  int frameIndex;
+  float frameTime;
+  const Camera &camera;
+  VkDescriptorSet globalDescriptorSet;
+  bool depthPrepass;
+};
+
+} // namespace engine
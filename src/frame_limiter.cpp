@@ -0,0 +1,38 @@
+#include "frame_limiter.hpp"
+
+#include <stdexcept>
+#include <thread>
+
+namespace engine {
+
+FrameLimiter::FrameLimiter(float targetFps) {
+  if (targetFps <= 0.f) {
+    throw std::runtime_error("Frame limit must be positive");
+  }
+  period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1.0 / targetFps));
+  nextFrame = Clock::now();
+}
+
+void FrameLimiter::wait() {
+  nextFrame += period;
+
+  auto now = Clock::now();
+  if (now >= nextFrame) {
+    // Running behind. Start a new schedule from now instead of rushing
+    // through frames to catch up.
+    if (now - nextFrame > period) {
+      nextFrame = now;
+    }
+    return;
+  }
+
+  if (nextFrame - now > SPIN_THRESHOLD) {
+    std::this_thread::sleep_for(nextFrame - now - SPIN_THRESHOLD);
+  }
+  while (Clock::now() < nextFrame) {
+    std::this_thread::yield();
+  }
+}
+
+} // namespace engine
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+
+namespace engine {
+
+// Paces the caller to a fixed rate. Sleeps until shortly before the
+// deadline and spins for the rest, since sleep granularity on most
+// platforms is too coarse to hit a frame boundary on its own.
+class FrameLimiter {
+public:
+  explicit FrameLimiter(float targetFps);
+
+  FrameLimiter(const FrameLimiter &) = delete;
+  FrameLimiter &operator=(const FrameLimiter &) = delete;
+
+  // Blocks until the next frame is due.
+  void wait();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  // Wake-up slack left to spinning. Covers the typical oversleep of a
+  // desktop scheduler.
+  static constexpr std::chrono::microseconds SPIN_THRESHOLD{1500};
+
+  Clock::duration period;
+  Clock::time_point nextFrame;
+};
+
+} // namespace engine
@@ -0,0 +1,299 @@
+#include "gpu_transforms.hpp"
+#include "embedded_shaders.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+namespace engine {
+
+// Laid out to match ObjectData in transform.comp and simple_shader.vert.
+struct GpuObjectData {
+  glm::mat4 modelMatrix;
+  glm::mat4 normalMatrix;
+};
+
+struct TransformPushConstants {
+  uint32_t first;
+  uint32_t count;
+};
+
+GpuTransforms::GpuTransforms(Device &device, uint32_t capacity,
+                             uint32_t framesInFlight)
+    : device{device}, capacity{capacity} {
+  createBuffers(framesInFlight);
+  createDescriptorSets();
+  createPipeline();
+}
+
+GpuTransforms::~GpuTransforms() {
+  vkDestroyPipeline(device.device(), pipeline, nullptr);
+  vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr);
+}
+
+void GpuTransforms::createBuffers(uint32_t framesInFlight) {
+  transformBuffer = std::make_unique<Buffer>(
+      device, sizeof(PackedTransform), capacity,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  objectBuffer = std::make_unique<Buffer>(
+      device, sizeof(GpuObjectData), capacity,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+  stagingBuffers.resize(framesInFlight);
+  for (auto &stagingBuffer : stagingBuffers) {
+    stagingBuffer = std::make_unique<Buffer>(
+        device, sizeof(PackedTransform), capacity,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    stagingBuffer->map();
+  }
+
+  parentBuffers.resize(framesInFlight);
+  orderBuffers.resize(framesInFlight);
+  hierarchyVersions.assign(framesInFlight, 0);
+  for (uint32_t i = 0; i < framesInFlight; i++) {
+    for (auto *buffer : {&parentBuffers[i], &orderBuffers[i]}) {
+      *buffer = std::make_unique<Buffer>(
+          device, sizeof(uint32_t), capacity,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      (*buffer)->map();
+    }
+  }
+}
+
+void GpuTransforms::createDescriptorSets() {
+  const auto framesInFlight = static_cast<uint32_t>(stagingBuffers.size());
+  descriptorPool = DescriptorPool::Builder(device)
+                       .setMaxSets(framesInFlight)
+                       .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                    4 * framesInFlight)
+                       .build();
+
+  descriptorSetLayout = DescriptorSetLayout::Builder(device)
+                            .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                        VK_SHADER_STAGE_COMPUTE_BIT)
+                            .addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                        VK_SHADER_STAGE_COMPUTE_BIT)
+                            .addBinding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                        VK_SHADER_STAGE_COMPUTE_BIT)
+                            .addBinding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                        VK_SHADER_STAGE_COMPUTE_BIT)
+                            .build();
+
+  descriptorSets.resize(framesInFlight, VK_NULL_HANDLE);
+  writeDescriptorSets();
+}
+
+// Allocates the sets the first time, afterwards points them at the current
+// buffers.
+void GpuTransforms::writeDescriptorSets() {
+  auto transformInfo = transformBuffer->descriptorInfo();
+  auto objectInfo = objectBuffer->descriptorInfo();
+  for (size_t i = 0; i < descriptorSets.size(); i++) {
+    auto parentInfo = parentBuffers[i]->descriptorInfo();
+    auto orderInfo = orderBuffers[i]->descriptorInfo();
+    DescriptorWriter writer{*descriptorSetLayout, *descriptorPool};
+    writer.writeBuffer(0, &transformInfo)
+        .writeBuffer(1, &objectInfo)
+        .writeBuffer(2, &parentInfo)
+        .writeBuffer(3, &orderInfo);
+    if (descriptorSets[i] == VK_NULL_HANDLE) {
+      writer.build(descriptorSets[i]);
+    } else {
+      writer.overwrite(descriptorSets[i]);
+    }
+  }
+}
+
+// Rare enough that waiting for the device is simpler than keeping the old
+// buffers alive for the frames in flight. The transforms held on the device
+// are lost, so update() uploads them all again.
+void GpuTransforms::grow(uint32_t objectCount) {
+  vkDeviceWaitIdle(device.device());
+  capacity = std::max(objectCount, 2 * capacity);
+  createBuffers(static_cast<uint32_t>(stagingBuffers.size()));
+  writeDescriptorSets();
+}
+
+void GpuTransforms::createPipeline() {
+  VkPushConstantRange pushConstantRange{};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(TransformPushConstants);
+
+  VkDescriptorSetLayout setLayout =
+      descriptorSetLayout->getDescriptorSetLayout();
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr,
+                             &pipelineLayout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create transform pipeline layout");
+  }
+
+  const EmbeddedShader *shader = findEmbeddedShader("transform.comp");
+  if (shader == nullptr) {
+    throw std::runtime_error("Failed to find shader: transform.comp");
+  }
+
+  VkShaderModuleCreateInfo moduleInfo{};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = shader->size;
+  moduleInfo.pCode = shader->code;
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device.device(), &moduleInfo, nullptr,
+                           &shaderModule) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shader module");
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo{};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  auto start = std::chrono::steady_clock::now();
+  VkResult result =
+      vkCreateComputePipelines(device.device(), device.pipelineCache(), 1,
+                               &pipelineInfo, nullptr, &pipeline);
+  device.recordPipelineCreation(std::chrono::steady_clock::now() - start);
+  vkDestroyShaderModule(device.device(), shaderModule, nullptr);
+
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create transform pipeline");
+  }
+}
+
+// Writes the dirty transforms to this frame's staging buffer, coalescing
+// neighbouring indices into one copy region each.
+bool GpuTransforms::update(Scene &scene, uint32_t frameIndex) {
+  bool reallocated = scene.size() > capacity;
+  if (reallocated) {
+    grow(scene.size());
+  }
+  objectCount = scene.size();
+
+  // Sorting may mark entities whose parent was destroyed dirty, so it goes
+  // first.
+  scene.updateHierarchy();
+  if (hierarchyVersions[frameIndex] != scene.getHierarchyVersion()) {
+    hierarchyVersions[frameIndex] = scene.getHierarchyVersion();
+    std::memcpy(parentBuffers[frameIndex]->getMappedMemory(),
+                scene.parentIndices(), objectCount * sizeof(uint32_t));
+    std::memcpy(orderBuffers[frameIndex]->getMappedMemory(),
+                scene.depthOrder(), objectCount * sizeof(uint32_t));
+  }
+  levelOffsets = scene.levelOffsets();
+
+  scene.collectDirtyTransforms(dirtyIndices);
+  if (reallocated) {
+    dirtyIndices.resize(objectCount);
+    std::iota(dirtyIndices.begin(), dirtyIndices.end(), 0u);
+  }
+  std::sort(dirtyIndices.begin(), dirtyIndices.end());
+  uploadCount = static_cast<uint32_t>(dirtyIndices.size());
+
+  auto *staging = static_cast<PackedTransform *>(
+      stagingBuffers[frameIndex]->getMappedMemory());
+  const glm::vec3 *translations = scene.translations();
+  const glm::vec3 *rotations = scene.rotations();
+  const glm::vec3 *scales = scene.scales();
+  constexpr VkDeviceSize STRIDE = sizeof(PackedTransform);
+
+  copyRegions.clear();
+  for (uint32_t i = 0; i < dirtyIndices.size(); i++) {
+    uint32_t index = dirtyIndices[i];
+    staging[i] = {glm::vec4{translations[index], 0.f},
+                  glm::vec4{rotations[index], 0.f},
+                  glm::vec4{scales[index], 0.f}};
+
+    if (i > 0 && dirtyIndices[i - 1] + 1 == index) {
+      copyRegions.back().size += STRIDE;
+    } else {
+      copyRegions.push_back({i * STRIDE, index * STRIDE, STRIDE});
+    }
+  }
+  return reallocated;
+}
+
+void GpuTransforms::record(VkCommandBuffer commandBuffer,
+                           uint32_t frameIndex) {
+  recordUpload(commandBuffer, frameIndex);
+
+  // The previous frame's draws may still read the matrices about to be
+  // overwritten.
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                       0, nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipelineLayout, 0, 1, &descriptorSets[frameIndex], 0,
+                          nullptr);
+
+  // Levels in order, each reading the matrices of the level before.
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  for (size_t level = 0; level + 1 < levelOffsets.size(); level++) {
+    if (level > 0) {
+      vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                           &barrier, 0, nullptr, 0, nullptr);
+    }
+    TransformPushConstants push{levelOffsets[level],
+                                levelOffsets[level + 1] - levelOffsets[level]};
+    vkCmdPushConstants(commandBuffer, pipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push), &push);
+    vkCmdDispatch(commandBuffer,
+                  (push.count + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+  }
+
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+void GpuTransforms::recordUpload(VkCommandBuffer commandBuffer,
+                                 uint32_t frameIndex) {
+  if (copyRegions.empty()) {
+    return;
+  }
+
+  // Earlier frames' dispatches may still read the transforms.
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  vkCmdCopyBuffer(commandBuffer, stagingBuffers[frameIndex]->getBuffer(),
+                  transformBuffer->getBuffer(),
+                  static_cast<uint32_t>(copyRegions.size()),
+                  copyRegions.data());
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+}
+
+} // namespace engine
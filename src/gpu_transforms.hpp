@@ -0,0 +1,97 @@
+#pragma once
+
+#include "buffer.hpp"
+#include "descriptors.hpp"
+#include "device.hpp"
+#include "scene.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+// Builds object model and normal matrices on the GPU (transform.comp)
+// instead of with trigonometry on the CPU. Packed transforms live in a
+// device-local buffer that only receives the scene's dirty entries each
+// frame, so CPU time and the upload follow the number of moving objects
+// rather than the object count. Parents are handled like
+// Scene::updateMatrices() does, one dispatch per hierarchy level.
+class GpuTransforms {
+public:
+  static constexpr uint32_t WORKGROUP_SIZE = 64;
+
+  // Matches PackedTransform in transform.comp (std430).
+  struct PackedTransform {
+    glm::vec4 translation{0.f};
+    glm::vec4 rotation{0.f};
+    glm::vec4 scale{1.f};
+  };
+
+  // Buffers start with room for capacity objects, e.g. the loaded scene,
+  // and grow when the scene outgrows them.
+  GpuTransforms(Device &device, uint32_t capacity, uint32_t framesInFlight);
+  ~GpuTransforms();
+
+  GpuTransforms(const GpuTransforms &) = delete;
+  GpuTransforms &operator=(const GpuTransforms &) = delete;
+
+  // Stages the transforms of the scene's dirty entities for this frame's
+  // record() and clears their dirty flags; Scene::updateMatrices() isn't
+  // used alongside. Call once per frame. Returns true if the buffers were
+  // reallocated for a larger scene, in which case getObjectBufferInfo() has
+  // changed.
+  bool update(Scene &scene, uint32_t frameIndex);
+
+  // Uploads what update() staged and computes the matrices of every object
+  // in the scene. Call outside a render pass, before any draw that reads the
+  // object buffer.
+  void record(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+  // ObjectData (model and normal matrix) per object, as simple_shader.vert
+  // reads it.
+  VkDescriptorBufferInfo getObjectBufferInfo() {
+    return objectBuffer->descriptorInfo();
+  }
+  // Transforms staged by the last update().
+  uint32_t getUploadCount() const { return uploadCount; }
+
+private:
+  void createBuffers(uint32_t framesInFlight);
+  void createDescriptorSets();
+  void writeDescriptorSets();
+  void grow(uint32_t objectCount);
+  void createPipeline();
+  void recordUpload(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+
+  Device &device;
+  uint32_t capacity;
+
+  std::vector<uint32_t> dirtyIndices;
+  uint32_t objectCount = 0;
+  uint32_t uploadCount = 0;
+  // Copied from the scene by update(), one dispatch each.
+  std::vector<uint32_t> levelOffsets;
+
+  std::unique_ptr<Buffer> transformBuffer;
+  std::unique_ptr<Buffer> objectBuffer;
+  // Per frame in flight, so uploads never overwrite data still being
+  // copied.
+  std::vector<std::unique_ptr<Buffer>> stagingBuffers;
+  std::vector<VkBufferCopy> copyRegions;
+  // Parent indices and depth order per frame in flight, rewritten only when
+  // the scene's hierarchy version moves past the one they hold.
+  std::vector<std::unique_ptr<Buffer>> parentBuffers;
+  std::vector<std::unique_ptr<Buffer>> orderBuffers;
+  std::vector<uint64_t> hierarchyVersions;
+
+  std::unique_ptr<DescriptorPool> descriptorPool;
+  std::unique_ptr<DescriptorSetLayout> descriptorSetLayout;
+  std::vector<VkDescriptorSet> descriptorSets;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+} // namespace engine
@@ -18,8 +18,20 @@ public:
     int lookDown = GLFW_KEY_DOWN;
   };
 
+  // Held keys as axes. Sampling has to happen on the main thread, but the
+  // input can then be applied on any thread.
+  struct Input {
+    glm::vec3 look{0.f};
+    // x is right, y is up, z is forward, relative to the object's yaw.
+    glm::vec3 move{0.f};
+  };
+
   void moveInPlaneXZ(GLFWwindow *window, float dt, GameObject &gameObject);
 
+  Input sampleInput(GLFWwindow *window) const;
+  void applyInput(const Input &input, float dt,
+                  TransformComponent &transform) const;
+
   KeyMappings keys{};
   float moveSpeed{3.f};
   float lookSpeed{1.5f};
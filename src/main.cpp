@@ -1,25 +1,142 @@
 #include "app.hpp"
+#include "bvh_benchmark.hpp"
+#include "scene_benchmark.hpp"
+#include "transform_benchmark.hpp"
 
 #include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <iostream>
 
-int main() {
-  engine::SwapChain::PresentMode presentMode = engine::SwapChain::FIFO;
+int main(int argc, char **argv) {
+  engine::App::Config config{};
+
+  // --headless renders offscreen at full speed, --frames N sets how many
+  // frames it renders before exiting. --capture-ppm DIR and --capture-raw
+  // FILE write out every frame. --dynamic-resolution scales the scene
+  // between --min-scale and --max-scale to meet --target-gpu-ms.
+  // --adaptive-vsync picks the present mode from frame timing.
+  // --no-dynamic-rendering keeps render pass objects even when dynamic
+  // rendering is available. --pipelined runs the simulation on its own
+  // thread, one frame ahead of rendering. --gpu-transforms computes object
+  // matrices in a compute pass. --pipeline-cache FILE sets where the
+  // pipeline cache is kept, --no-pipeline-cache disables it.
+  // --shader-dir DIR loads <shader>.spv files from DIR over the embedded
+  // shaders, e.g. output of compile_shaders.sh. --bench NAME runs a CPU
+  // benchmark instead of the app, NAME is one of: scene, hierarchy,
+  // transforms, bvh.
+  std::string bench;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--headless") == 0) {
+      config.headless = true;
+    } else if (std::strcmp(argv[i], "--capture-ppm") == 0 && i + 1 < argc) {
+      config.capture = true;
+      config.captureFormat = engine::FrameCapture::Format::PPM;
+      config.capturePath = argv[++i];
+    } else if (std::strcmp(argv[i], "--capture-raw") == 0 && i + 1 < argc) {
+      config.capture = true;
+      config.captureFormat = engine::FrameCapture::Format::RawVideo;
+      config.capturePath = argv[++i];
+    } else if (std::strcmp(argv[i], "--no-dynamic-rendering") == 0) {
+      config.dynamicRendering = false;
+    } else if (std::strcmp(argv[i], "--adaptive-vsync") == 0) {
+      config.adaptivePresentMode = true;
+    } else if (std::strcmp(argv[i], "--pipeline-cache") == 0 &&
+               i + 1 < argc) {
+      config.pipelineCachePath = argv[++i];
+    } else if (std::strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc) {
+      config.shaderOverrideDir = argv[++i];
+    } else if (std::strcmp(argv[i], "--no-pipeline-cache") == 0) {
+      config.pipelineCachePath.clear();
+    } else if (std::strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      bench = argv[++i];
+    } else if (std::strcmp(argv[i], "--gpu-transforms") == 0) {
+      config.gpuTransforms = true;
+    } else if (std::strcmp(argv[i], "--pipelined") == 0) {
+      config.pipelined = true;
+    } else if (std::strcmp(argv[i], "--dynamic-resolution") == 0) {
+      config.dynamicResolution = true;
+    } else if (std::strcmp(argv[i], "--min-scale") == 0 && i + 1 < argc) {
+      config.resolution.minScale = static_cast<float>(std::atof(argv[++i]));
+    } else if (std::strcmp(argv[i], "--max-scale") == 0 && i + 1 < argc) {
+      config.resolution.maxScale = static_cast<float>(std::atof(argv[++i]));
+    } else if (std::strcmp(argv[i], "--target-gpu-ms") == 0 && i + 1 < argc) {
+      config.resolution.targetGpuMs =
+          static_cast<float>(std::atof(argv[++i]));
+    } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+      int frames = std::atoi(argv[++i]);
+      if (frames > 0) {
+        config.frameCount = static_cast<uint32_t>(frames);
+      } else {
+        std::cerr << "--frames must be positive, using " << config.frameCount
+                  << std::endl;
+      }
+    } else {
+      std::cerr << "Unknown argument: " << argv[i] << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (bench == "scene") {
+    engine::runSceneBenchmark();
+    return EXIT_SUCCESS;
+  } else if (bench == "hierarchy") {
+    engine::runHierarchyBenchmark();
+    return EXIT_SUCCESS;
+  } else if (bench == "transforms") {
+    return engine::runTransformBenchmark() ? EXIT_SUCCESS : EXIT_FAILURE;
+  } else if (bench == "bvh") {
+    engine::runBvhBenchmark();
+    return EXIT_SUCCESS;
+  } else if (!bench.empty()) {
+    std::cerr << "Unknown benchmark: " << bench << std::endl;
+    return EXIT_FAILURE;
+  }
+
   const char *pPresentModeChars = std::getenv("PRESENT_MODE");
 
   if (pPresentModeChars != nullptr) {
     std::string presentModeStr = pPresentModeChars;
     if (presentModeStr == "FIFO") {
-      presentMode = engine::SwapChain::FIFO;
+      config.presentMode = engine::SwapChain::FIFO;
+    } else if (presentModeStr == "FIFO_RELAXED") {
+      config.presentMode = engine::SwapChain::FIFO_RELAXED;
     } else if (presentModeStr == "MAILBOX") {
-      presentMode = engine::SwapChain::MAILBOX;
+      config.presentMode = engine::SwapChain::MAILBOX;
     } else if (presentModeStr == "IMMEDIATE") {
-      presentMode = engine::SwapChain::IMMEDIATE;
+      config.presentMode = engine::SwapChain::IMMEDIATE;
     }
   }
 
-  engine::App app{presentMode};
+  // Fewer frames in flight lower latency, more give the CPU and GPU room to
+  // overlap.
+  const char *pFramesInFlightChars = std::getenv("FRAMES_IN_FLIGHT");
+
+  if (pFramesInFlightChars != nullptr) {
+    int requested = std::atoi(pFramesInFlightChars);
+    int minFrames = engine::Renderer::MIN_FRAMES_IN_FLIGHT;
+    int maxFrames = engine::Renderer::MAX_FRAMES_IN_FLIGHT;
+    if (requested >= minFrames && requested <= maxFrames) {
+      config.framesInFlight = static_cast<uint32_t>(requested);
+    } else {
+      std::cerr << "FRAMES_IN_FLIGHT must be between " << minFrames << " and "
+                << maxFrames << ", using " << config.framesInFlight
+                << std::endl;
+    }
+  }
+
+  // Samples input after waiting for the frame slot instead of before.
+  const char *pLowLatencyChars = std::getenv("LOW_LATENCY");
+  if (pLowLatencyChars != nullptr) {
+    config.lowLatency = std::string{pLowLatencyChars} == "1";
+  }
+
+  const char *pFpsLimitChars = std::getenv("FPS_LIMIT");
+  if (pFpsLimitChars != nullptr) {
+    config.fpsLimit = static_cast<float>(std::atof(pFpsLimitChars));
+  }
+
+  engine::App app{config};
 
   try {
     app.run();
@@ -27,17 +27,29 @@ template <> struct hash<engine::Model::Vertex> {
 namespace engine {
 
 Model::Model(Device &device, const Model::Builder &builder) : device(device) {
+  for (const auto &vertex : builder.vertices) {
+    bounds.expand(vertex.position);
+  }
   createVertexBuffers(builder.vertices);
   createIndexBuffers(builder.indices);
 }
 
+// Frames still in flight may draw this model, so its buffers outlive it
+// until they retire.
 Model::~Model() {
-  vkDestroyBuffer(device.device(), vertexBuffer, nullptr);
-  vkFreeMemory(device.device(), vertexBufferMemory, nullptr);
+  VkDevice vkDevice = device.device();
+  device.deferDestroy([vkDevice, buffer = vertexBuffer,
+                       memory = vertexBufferMemory] {
+    vkDestroyBuffer(vkDevice, buffer, nullptr);
+    vkFreeMemory(vkDevice, memory, nullptr);
+  });
 
   if (hasIndexBuffer) {
-    vkDestroyBuffer(device.device(), indexBuffer, nullptr);
-    vkFreeMemory(device.device(), indexBufferMemory, nullptr);
+    device.deferDestroy([vkDevice, buffer = indexBuffer,
+                         memory = indexBufferMemory] {
+      vkDestroyBuffer(vkDevice, buffer, nullptr);
+      vkFreeMemory(vkDevice, memory, nullptr);
+    });
   }
 }
 
@@ -58,11 +70,11 @@ void Model::bind(VkCommandBuffer commandBuffer) {
   }
 }
 
-void Model::draw(VkCommandBuffer commandBuffer) {
+void Model::draw(VkCommandBuffer commandBuffer, uint32_t firstInstance) {
   if (hasIndexBuffer) {
-    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, 0);
+    vkCmdDrawIndexed(commandBuffer, indexCount, 1, 0, 0, firstInstance);
   } else {
-    vkCmdDraw(commandBuffer, vertexCount, 1, 0, 0);
+    vkCmdDraw(commandBuffer, vertexCount, 1, 0, firstInstance);
   }
 }
 
@@ -154,6 +166,11 @@ Model::Vertex::getAttributeDescriptions() {
   return attributeDescriptions;
 }
 
+std::vector<VkVertexInputAttributeDescription>
+Model::Vertex::getPositionAttributeDescriptions() {
+  return {{0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, position)}};
+}
+
 void Model::Builder::loadModel(const std::string &filepath) {
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "bounds.hpp"
 #include "device.hpp"
 
 #define GLM_FORCE_RADIANS
@@ -24,6 +25,8 @@ public:
     getBindingDescriptions();
     static std::vector<VkVertexInputAttributeDescription>
     getAttributeDescriptions();
+    static std::vector<VkVertexInputAttributeDescription>
+    getPositionAttributeDescriptions();
 
     bool operator==(const Vertex &other) const {
       return position == other.position && color == other.color &&
@@ -47,14 +50,18 @@ public:
   static std::unique_ptr<Model> createFromFile(Device &device,
                                                const std::string &filepath);
 
+  // In model space, over all vertices.
+  const Aabb &getBounds() const { return bounds; }
+
   void bind(VkCommandBuffer commandBuffer);
-  void draw(VkCommandBuffer commandBuffer);
+  void draw(VkCommandBuffer commandBuffer, uint32_t firstInstance = 0);
 
 private:
   void createVertexBuffers(const std::vector<Vertex> &vertices);
   void createIndexBuffers(const std::vector<uint32_t> &indices);
 
   Device &device;
+  Aabb bounds;
 
   VkBuffer vertexBuffer;
   VkDeviceMemory vertexBufferMemory;
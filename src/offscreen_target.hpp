@@ -0,0 +1,60 @@
+#pragma once
+
+#include "device.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+
+namespace engine {
+
+// Stands in for a swap chain when rendering headless: a ring of color images
+// that are rendered to and never presented. Getters mirror SwapChain so the
+// renderer can treat both the same way.
+class OffscreenTarget {
+public:
+  OffscreenTarget(Device &deviceRef, VkExtent2D extent, uint32_t imageCount);
+  ~OffscreenTarget();
+
+  OffscreenTarget(const OffscreenTarget &) = delete;
+  OffscreenTarget &operator=(const OffscreenTarget &) = delete;
+
+  // Compatible with the render passes the render graph builds for a color
+  // attachment in the target format followed by a depth attachment. Null
+  // with dynamic rendering.
+  VkRenderPass getRenderPass() { return renderPass; }
+  VkImage getImage(int index) { return colorImages[index]; }
+  VkImageView getImageView(int index) { return colorImageViews[index]; }
+  size_t imageCount() { return colorImages.size(); }
+  VkFormat getImageFormat() { return colorFormat; }
+  VkFormat getDepthFormat() { return depthFormat; }
+  VkExtent2D getExtent() { return extent; }
+  VkImageUsageFlags getImageUsage() { return IMAGE_USAGE; }
+
+  float extentAspectRatio() {
+    return static_cast<float>(extent.width) /
+           static_cast<float>(extent.height);
+  }
+
+private:
+  // Transfer usage so a frame can be read back or blitted into.
+  static constexpr VkImageUsageFlags IMAGE_USAGE =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+  void createImages(uint32_t imageCount);
+  void createRenderPass();
+
+  Device &device;
+  VkExtent2D extent;
+  VkFormat colorFormat;
+  VkFormat depthFormat;
+
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+
+  std::vector<VkImage> colorImages;
+  std::vector<VkDeviceMemory> colorImageMemories;
+  std::vector<VkImageView> colorImageViews;
+};
+
+} // namespace engine
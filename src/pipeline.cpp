@@ -4,45 +4,29 @@
 #include <cassert>
 #include <vulkan/vulkan_core.h>
 
-#include <fstream>
+#include <chrono>
 #include <iostream>
 #include <stdexcept>
 
 namespace engine {
 
-std::vector<char> Pipeline::readFile(const std::string &filePath) {
-  std::ifstream file{filePath, std::ios::ate | std::ios::binary};
-
-  if (!file.is_open()) {
-    throw std::runtime_error("Failed to open file: " + filePath);
-  }
-
-  size_t fileSize = static_cast<size_t>(file.tellg());
-  std::vector<char> buffer(fileSize);
-
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-
-  file.close();
-  return buffer;
-}
-
-void Pipeline::createGraphicsPipeline(const std::string &vertFilepath,
-                                      const std::string &fragFilepath,
+void Pipeline::createGraphicsPipeline(VkShaderModule vertShaderModule,
+                                      VkShaderModule fragShaderModule,
                                       const PipelineConfigInfo &configInfo) {
   assert(configInfo.pipelineLayout != VK_NULL_HANDLE &&
          "Cannot create graphics pipeline:: no pipelineLayout provided in "
          "configInfo");
 
-  assert(
-      configInfo.renderPass != VK_NULL_HANDLE &&
-      "Cannot create graphics pipeline:: no renderPass provided in configInfo");
-
-  auto vertCode = readFile(vertFilepath);
-  auto fragCode = readFile(fragFilepath);
+  assert((configInfo.renderPass != VK_NULL_HANDLE ||
+          configInfo.colorAttachmentFormat != VK_FORMAT_UNDEFINED ||
+          configInfo.depthAttachmentFormat != VK_FORMAT_UNDEFINED) &&
+         "Cannot create graphics pipeline:: no renderPass or attachment "
+         "formats provided in configInfo");
 
-  createShaderModule(vertCode, &vertShaderModule);
-  createShaderModule(fragCode, &fragShaderModule);
+  VkSpecializationInfo vertSpecializationInfo =
+      configInfo.vertSpecialization.getInfo();
+  VkSpecializationInfo fragSpecializationInfo =
+      configInfo.fragSpecialization.getInfo();
 
   VkPipelineShaderStageCreateInfo shaderStages[2];
 
@@ -52,18 +36,27 @@ void Pipeline::createGraphicsPipeline(const std::string &vertFilepath,
   shaderStages[0].pName = "main";
   shaderStages[0].flags = 0;
   shaderStages[0].pNext = nullptr;
-  shaderStages[0].pSpecializationInfo = nullptr;
-
-  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  shaderStages[1].module = fragShaderModule;
-  shaderStages[1].pName = "main";
-  shaderStages[1].flags = 0;
-  shaderStages[1].pNext = nullptr;
-  shaderStages[1].pSpecializationInfo = nullptr;
+  shaderStages[0].pSpecializationInfo = configInfo.vertSpecialization.empty()
+                                           ? nullptr
+                                           : &vertSpecializationInfo;
+
+  uint32_t stageCount = 1;
+  if (fragShaderModule != VK_NULL_HANDLE) {
+    shaderStages[1].sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shaderStages[1].module = fragShaderModule;
+    shaderStages[1].pName = "main";
+    shaderStages[1].flags = 0;
+    shaderStages[1].pNext = nullptr;
+    shaderStages[1].pSpecializationInfo =
+        configInfo.fragSpecialization.empty() ? nullptr
+                                              : &fragSpecializationInfo;
+    stageCount++;
+  }
 
-  auto bindingDescriptions = Model::Vertex::getBindingDescriptions();
-  auto attributeDescriptions = Model::Vertex::getAttributeDescriptions();
+  auto &bindingDescriptions = configInfo.bindingDescriptions;
+  auto &attributeDescriptions = configInfo.attributeDescriptions;
 
   VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
   vertexInputInfo.sType =
@@ -77,7 +70,7 @@ void Pipeline::createGraphicsPipeline(const std::string &vertFilepath,
 
   VkGraphicsPipelineCreateInfo pipelineInfo{};
   pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
+  pipelineInfo.stageCount = stageCount;
   pipelineInfo.pStages = shaderStages;
   pipelineInfo.pVertexInputState = &vertexInputInfo;
   pipelineInfo.pInputAssemblyState = &configInfo.inputAssemblyInfo;
@@ -93,39 +86,37 @@ void Pipeline::createGraphicsPipeline(const std::string &vertFilepath,
   pipelineInfo.renderPass = configInfo.renderPass;
   pipelineInfo.subpass = configInfo.subpass;
 
+  VkPipelineRenderingCreateInfoKHR renderingInfo{};
+  if (configInfo.renderPass == VK_NULL_HANDLE) {
+    renderingInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+    if (configInfo.colorAttachmentFormat != VK_FORMAT_UNDEFINED) {
+      renderingInfo.colorAttachmentCount = 1;
+      renderingInfo.pColorAttachmentFormats = &configInfo.colorAttachmentFormat;
+    }
+    renderingInfo.depthAttachmentFormat = configInfo.depthAttachmentFormat;
+    pipelineInfo.pNext = &renderingInfo;
+  }
+
   pipelineInfo.basePipelineIndex = -1;
   pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-  if (vkCreateGraphicsPipelines(device.device(), VK_NULL_HANDLE, 1,
+  auto start = std::chrono::steady_clock::now();
+  if (vkCreateGraphicsPipelines(device.device(), device.pipelineCache(), 1,
                                 &pipelineInfo, nullptr,
                                 &graphicsPipeline) != VK_SUCCESS) {
     throw std::runtime_error("Failed to create graphics pipeline");
   }
+  device.recordPipelineCreation(std::chrono::steady_clock::now() - start);
 }
 
-void Pipeline::createShaderModule(const std::vector<char> &code,
-                                  VkShaderModule *shaderModule) {
-  VkShaderModuleCreateInfo createInfo{};
-  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  createInfo.codeSize = code.size();
-  createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
-
-  if (vkCreateShaderModule(device.device(), &createInfo, nullptr,
-                           shaderModule) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create shader module");
-  }
-}
-
-Pipeline::Pipeline(Device &device, const std::string &vertFilepath,
-                   const std::string &fragFilepath,
+Pipeline::Pipeline(Device &device, VkShaderModule vertShaderModule,
+                   VkShaderModule fragShaderModule,
                    const PipelineConfigInfo &configInfo)
     : device(device) {
-  createGraphicsPipeline(vertFilepath, fragFilepath, configInfo);
+  createGraphicsPipeline(vertShaderModule, fragShaderModule, configInfo);
 }
 
 Pipeline::~Pipeline() {
-  vkDestroyShaderModule(device.device(), vertShaderModule, nullptr);
-  vkDestroyShaderModule(device.device(), fragShaderModule, nullptr);
   vkDestroyPipeline(device.device(), graphicsPipeline, nullptr);
 }
 
@@ -134,6 +125,32 @@ void Pipeline::bind(VkCommandBuffer commandBuffer) {
                     graphicsPipeline);
 }
 
+void PipelineConfigInfo::copyFrom(const PipelineConfigInfo &other) {
+  bindingDescriptions = other.bindingDescriptions;
+  attributeDescriptions = other.attributeDescriptions;
+  viewportInfo = other.viewportInfo;
+  inputAssemblyInfo = other.inputAssemblyInfo;
+  rasterizationInfo = other.rasterizationInfo;
+  multisampleInfo = other.multisampleInfo;
+  colorBlendAttachment = other.colorBlendAttachment;
+  colorBlendInfo = other.colorBlendInfo;
+  depthStencilInfo = other.depthStencilInfo;
+  dynamicStateEnables = other.dynamicStateEnables;
+  dynamicStateInfo = other.dynamicStateInfo;
+  pipelineLayout = other.pipelineLayout;
+  renderPass = other.renderPass;
+  subpass = other.subpass;
+  colorAttachmentFormat = other.colorAttachmentFormat;
+  depthAttachmentFormat = other.depthAttachmentFormat;
+  vertSpecialization = other.vertSpecialization;
+  fragSpecialization = other.fragSpecialization;
+
+  if (colorBlendInfo.pAttachments != nullptr) {
+    colorBlendInfo.pAttachments = &colorBlendAttachment;
+  }
+  dynamicStateInfo.pDynamicStates = dynamicStateEnables.data();
+}
+
 void Pipeline::defaultPipelineConfigInfo(PipelineConfigInfo &configInfo) {
   configInfo.inputAssemblyInfo.sType =
       VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
@@ -216,6 +233,17 @@ void Pipeline::defaultPipelineConfigInfo(PipelineConfigInfo &configInfo) {
   configInfo.dynamicStateInfo.dynamicStateCount =
       static_cast<uint32_t>(configInfo.dynamicStateEnables.size());
   configInfo.dynamicStateInfo.flags = 0;
+
+  configInfo.bindingDescriptions = Model::Vertex::getBindingDescriptions();
+  configInfo.attributeDescriptions = Model::Vertex::getAttributeDescriptions();
+}
+
+void Pipeline::depthOnlyPipelineConfigInfo(PipelineConfigInfo &configInfo) {
+  defaultPipelineConfigInfo(configInfo);
+
+  configInfo.colorBlendAttachment.colorWriteMask = 0;
+  configInfo.attributeDescriptions =
+      Model::Vertex::getPositionAttributeDescriptions();
 }
 
 } // namespace engine
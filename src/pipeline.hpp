@@ -2,16 +2,62 @@
 
 #include "device.hpp"
 
+#include <cstring>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
 namespace engine {
 
+// What pipelines render into: a compatible render pass or, when it is null
+// (dynamic rendering), just the attachment formats.
+struct RenderTargetLayout {
+  VkRenderPass renderPass = VK_NULL_HANDLE;
+  VkFormat colorFormat = VK_FORMAT_UNDEFINED;
+  VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+};
+
+// Values for one shader stage's specialization constants
+// (layout(constant_id = N) in GLSL). Kept by value so configs can be copied
+// and compared. Set each id once; bool constants take a VkBool32.
+class SpecializationConstants {
+public:
+  template <typename T>
+  SpecializationConstants &set(uint32_t constantId, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Specialization constants must be plain values");
+    entries.push_back(
+        {constantId, static_cast<uint32_t>(data.size()), sizeof(T)});
+    data.resize(data.size() + sizeof(T));
+    std::memcpy(data.data() + data.size() - sizeof(T), &value, sizeof(T));
+    return *this;
+  }
+
+  bool empty() const { return entries.empty(); }
+  const std::vector<VkSpecializationMapEntry> &getEntries() const {
+    return entries;
+  }
+  const std::vector<char> &getData() const { return data; }
+
+  // Points into this object.
+  VkSpecializationInfo getInfo() const {
+    return {static_cast<uint32_t>(entries.size()), entries.data(),
+            data.size(), data.data()};
+  }
+
+private:
+  std::vector<VkSpecializationMapEntry> entries;
+  std::vector<char> data;
+};
+
 struct PipelineConfigInfo {
+  PipelineConfigInfo() = default;
   PipelineConfigInfo(const PipelineConfigInfo &) = delete;
   PipelineConfigInfo &operator=(const PipelineConfigInfo &) = delete;
 
+  std::vector<VkVertexInputBindingDescription> bindingDescriptions{};
+  std::vector<VkVertexInputAttributeDescription> attributeDescriptions{};
   VkPipelineViewportStateCreateInfo viewportInfo;
   VkPipelineInputAssemblyStateCreateInfo inputAssemblyInfo;
   VkPipelineRasterizationStateCreateInfo rasterizationInfo;
@@ -24,12 +70,31 @@ struct PipelineConfigInfo {
   VkPipelineLayout pipelineLayout = nullptr;
   VkRenderPass renderPass = nullptr;
   uint32_t subpass = 0;
+  // Used instead of renderPass when it is null.
+  VkFormat colorAttachmentFormat = VK_FORMAT_UNDEFINED;
+  VkFormat depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+  SpecializationConstants vertSpecialization;
+  SpecializationConstants fragSpecialization;
+
+  // Copies every field and repoints the internal pointers (blend
+  // attachments, dynamic states) at this object's own members.
+  void copyFrom(const PipelineConfigInfo &other);
+
+  void setRenderTarget(const RenderTargetLayout &target) {
+    renderPass = target.renderPass;
+    colorAttachmentFormat = target.colorFormat;
+    depthAttachmentFormat = target.depthFormat;
+  }
 };
 
+// Pipelines are normally obtained from a PipelineRegistry, which shares
+// them between render systems and owns the shader modules.
 class Pipeline {
 public:
-  Pipeline(Device &device, const std::string &vertFilepath,
-           const std::string &fragFilepath,
+  // A null fragShaderModule builds a vertex-only pipeline (e.g. depth-only).
+  // The modules only need to outlive the constructor.
+  Pipeline(Device &device, VkShaderModule vertShaderModule,
+           VkShaderModule fragShaderModule,
            const PipelineConfigInfo &configInfo);
 
   ~Pipeline();
@@ -39,21 +104,15 @@ public:
 
   void bind(VkCommandBuffer commandBuffer);
   static void defaultPipelineConfigInfo(PipelineConfigInfo &configInfo);
+  static void depthOnlyPipelineConfigInfo(PipelineConfigInfo &configInfo);
 
 private:
-  static std::vector<char> readFile(const std::string &filePath);
-
-  void createGraphicsPipeline(const std::string &vertFilepath,
-                              const std::string &fragFilepath,
+  void createGraphicsPipeline(VkShaderModule vertShaderModule,
+                              VkShaderModule fragShaderModule,
                               const PipelineConfigInfo &configInfo);
 
-  void createShaderModule(const std::vector<char> &code,
-                          VkShaderModule *shaderModule);
-
   Device &device;
   VkPipeline graphicsPipeline;
-  VkShaderModule vertShaderModule;
-  VkShaderModule fragShaderModule;
 };
 
 } // namespace engine
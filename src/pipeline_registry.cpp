@@ -0,0 +1,337 @@
+#include "pipeline_registry.hpp"
+#include "embedded_shaders.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace engine {
+
+namespace {
+
+// Serializes pipeline state field by field, so padding and the pointers
+// inside the create info structs never end up in a key.
+class KeyWriter {
+public:
+  template <typename T> KeyWriter &operator<<(const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Only plain values can be written to a pipeline key");
+    key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    return *this;
+  }
+
+  KeyWriter &operator<<(const std::string &value) {
+    *this << value.size();
+    key += value;
+    return *this;
+  }
+
+  KeyWriter &operator<<(const SpecializationConstants &constants) {
+    *this << constants.getEntries().size();
+    for (const auto &entry : constants.getEntries()) {
+      *this << entry.constantID << entry.offset << entry.size;
+    }
+    const auto &data = constants.getData();
+    return *this << std::string(data.begin(), data.end());
+  }
+
+  KeyWriter &operator<<(const VkStencilOpState &state) {
+    return *this << state.failOp << state.passOp << state.depthFailOp
+                 << state.compareOp << state.compareMask << state.writeMask
+                 << state.reference;
+  }
+
+  std::string key;
+};
+
+} // namespace
+
+AsyncPipeline::AsyncPipeline(std::shared_ptr<Pipeline> fallback,
+                             std::atomic<uint64_t> &fallbackBinds)
+    : fallback{std::move(fallback)}, fallbackBinds{fallbackBinds} {}
+
+void AsyncPipeline::bind(VkCommandBuffer commandBuffer) {
+  if (isReady()) {
+    pipeline->bind(commandBuffer);
+  } else {
+    fallbackBinds.fetch_add(1, std::memory_order_relaxed);
+    fallback->bind(commandBuffer);
+  }
+}
+
+void AsyncPipeline::resolve(std::shared_ptr<Pipeline> compiled) {
+  pipeline = std::move(compiled);
+  ready.store(true, std::memory_order_release);
+}
+
+PipelineRegistry::ShaderModule::ShaderModule(Device &device,
+                                             const uint32_t *code,
+                                             size_t size)
+    : device{device} {
+  VkShaderModuleCreateInfo createInfo{};
+  createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  createInfo.codeSize = size;
+  createInfo.pCode = code;
+
+  if (vkCreateShaderModule(device.device(), &createInfo, nullptr, &module) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to create shader module");
+  }
+}
+
+PipelineRegistry::ShaderModule::~ShaderModule() {
+  vkDestroyShaderModule(device.device(), module, nullptr);
+}
+
+PipelineRegistry::PipelineRegistry(Device &device,
+                                   const std::string &shaderOverrideDir)
+    : device{device}, shaderOverrideDir{shaderOverrideDir} {}
+
+std::shared_ptr<Pipeline>
+PipelineRegistry::getPipeline(const std::string &vertShaderName,
+                              const std::string &fragShaderName,
+                              const PipelineConfigInfo &configInfo) {
+  auto key = makeKey(vertShaderName, fragShaderName, configInfo);
+  std::shared_ptr<ShaderModule> vertShader;
+  std::shared_ptr<ShaderModule> fragShader;
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stats.requests++;
+    auto found = pipelines.find(key);
+    if (found != pipelines.end()) {
+      return found->second;
+    }
+    vertShader = getShaderModule(vertShaderName);
+    if (!fragShaderName.empty()) {
+      fragShader = getShaderModule(fragShaderName);
+    }
+  }
+
+  auto start = Clock::now();
+  auto pipeline = std::make_shared<Pipeline>(
+      device, vertShader->module,
+      fragShader ? fragShader->module : VK_NULL_HANDLE, configInfo);
+  float compileMs =
+      std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+  std::lock_guard<std::mutex> lock{mutex};
+  if (compileMs > HITCH_THRESHOLD_MS) {
+    stats.hitches++;
+  }
+  return addPipeline(key, std::move(pipeline));
+}
+
+std::shared_ptr<AsyncPipeline>
+PipelineRegistry::requestPipeline(const std::string &vertShaderName,
+                                  const std::string &fragShaderName,
+                                  const PipelineConfigInfo &configInfo,
+                                  std::shared_ptr<Pipeline> fallback) {
+  auto key = makeKey(vertShaderName, fragShaderName, configInfo);
+  auto request = std::make_shared<AsyncPipeline>(fallback, fallbackBinds);
+
+  std::lock_guard<std::mutex> lock{mutex};
+  stats.requests++;
+  auto found = pipelines.find(key);
+  if (found != pipelines.end()) {
+    request->resolve(found->second);
+    return request;
+  }
+  if (failedKeys.count(key) > 0) {
+    request->fail();
+    return request;
+  }
+  auto compiling = pending.find(key);
+  if (compiling != pending.end()) {
+    if (auto shared = compiling->second.lock()) {
+      return shared;
+    }
+  }
+
+  // The job gets its own copy of everything it reads, the caller's config
+  // may be gone by the time it runs.
+  auto vertShader = getShaderModule(vertShaderName);
+  auto fragShader =
+      fragShaderName.empty() ? nullptr : getShaderModule(fragShaderName);
+  auto config = std::make_shared<PipelineConfigInfo>();
+  config->copyFrom(configInfo);
+  pending[key] = request;
+  stats.pending++;
+
+  auto requested = Clock::now();
+  compiler.submit([this, key, request, vertShader, fragShader, config,
+                   requested] {
+    std::shared_ptr<Pipeline> pipeline;
+    try {
+      pipeline = std::make_shared<Pipeline>(
+          device, vertShader->module,
+          fragShader ? fragShader->module : VK_NULL_HANDLE, *config);
+    } catch (const std::exception &e) {
+      std::cerr << "Pipeline compile failed, keeping the fallback: "
+                << e.what() << std::endl;
+    }
+    float latencyMs =
+        std::chrono::duration<float, std::milli>(Clock::now() - requested)
+            .count();
+
+    std::lock_guard<std::mutex> lock{mutex};
+    pending.erase(key);
+    if (--stats.pending == 0) {
+      shaderModules.clear();
+    }
+    if (!pipeline) {
+      failedKeys.insert(key);
+      stats.failed++;
+      request->fail();
+      return;
+    }
+    request->resolve(addPipeline(key, std::move(pipeline)));
+    asyncCompiled++;
+    totalCompileLatencyMs += latencyMs;
+    stats.maxCompileLatencyMs = std::max(stats.maxCompileLatencyMs, latencyMs);
+  });
+  return request;
+}
+
+void PipelineRegistry::releaseShaderModules() {
+  std::lock_guard<std::mutex> lock{mutex};
+  shaderModules.clear();
+}
+
+PipelineRegistry::Stats PipelineRegistry::getStats() {
+  std::lock_guard<std::mutex> lock{mutex};
+  Stats current = stats;
+  current.compiled = static_cast<uint32_t>(pipelines.size());
+  if (asyncCompiled > 0) {
+    current.averageCompileLatencyMs = totalCompileLatencyMs / asyncCompiled;
+  }
+  current.fallbackBinds = fallbackBinds.load(std::memory_order_relaxed);
+  return current;
+}
+
+std::shared_ptr<Pipeline>
+PipelineRegistry::addPipeline(const std::string &key,
+                              std::shared_ptr<Pipeline> pipeline) {
+  // Another thread may have compiled the same pipeline meanwhile; the first
+  // one wins so every user shares it.
+  return pipelines.emplace(key, std::move(pipeline)).first->second;
+}
+
+// Empty if the file can't be opened.
+std::vector<uint32_t> PipelineRegistry::readFile(const std::string &filePath) {
+  std::ifstream file{filePath, std::ios::ate | std::ios::binary};
+
+  if (!file.is_open()) {
+    return {};
+  }
+
+  size_t fileSize = static_cast<size_t>(file.tellg());
+  if (fileSize == 0 || fileSize % sizeof(uint32_t) != 0) {
+    throw std::runtime_error("Failed to load shader: " + filePath +
+                             " is not SPIR-V");
+  }
+  std::vector<uint32_t> buffer(fileSize / sizeof(uint32_t));
+
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(buffer.data()), fileSize);
+
+  file.close();
+  return buffer;
+}
+
+std::shared_ptr<PipelineRegistry::ShaderModule>
+PipelineRegistry::getShaderModule(const std::string &name) {
+  auto found = shaderModules.find(name);
+  if (found != shaderModules.end()) {
+    return found->second;
+  }
+
+  std::shared_ptr<ShaderModule> shaderModule;
+  std::vector<uint32_t> code;
+  if (!shaderOverrideDir.empty()) {
+    code = readFile(shaderOverrideDir + "/" + name + ".spv");
+  }
+  if (!code.empty()) {
+    shaderModule = std::make_shared<ShaderModule>(
+        device, code.data(), code.size() * sizeof(uint32_t));
+  } else if (auto *embedded = findEmbeddedShader(name)) {
+    shaderModule =
+        std::make_shared<ShaderModule>(device, embedded->code, embedded->size);
+  } else {
+    throw std::runtime_error("Failed to find shader: " + name);
+  }
+
+  shaderModules.emplace(name, shaderModule);
+  return shaderModule;
+}
+
+// Covers every field Pipeline::createGraphicsPipeline reads. The viewport
+// and scissor counts are all that matters while they are dynamic state.
+std::string PipelineRegistry::makeKey(const std::string &vertShaderName,
+                                      const std::string &fragShaderName,
+                                      const PipelineConfigInfo &configInfo) {
+  KeyWriter writer;
+  writer << vertShaderName << configInfo.vertSpecialization << fragShaderName
+         << configInfo.fragSpecialization;
+
+  writer << configInfo.bindingDescriptions.size();
+  for (const auto &binding : configInfo.bindingDescriptions) {
+    writer << binding.binding << binding.stride << binding.inputRate;
+  }
+  writer << configInfo.attributeDescriptions.size();
+  for (const auto &attribute : configInfo.attributeDescriptions) {
+    writer << attribute.location << attribute.binding << attribute.format
+           << attribute.offset;
+  }
+
+  writer << configInfo.viewportInfo.viewportCount
+         << configInfo.viewportInfo.scissorCount;
+
+  const auto &inputAssembly = configInfo.inputAssemblyInfo;
+  writer << inputAssembly.topology << inputAssembly.primitiveRestartEnable;
+
+  const auto &rasterization = configInfo.rasterizationInfo;
+  writer << rasterization.depthClampEnable
+         << rasterization.rasterizerDiscardEnable << rasterization.polygonMode
+         << rasterization.cullMode << rasterization.frontFace
+         << rasterization.depthBiasEnable
+         << rasterization.depthBiasConstantFactor
+         << rasterization.depthBiasClamp << rasterization.depthBiasSlopeFactor
+         << rasterization.lineWidth;
+
+  const auto &multisample = configInfo.multisampleInfo;
+  writer << multisample.rasterizationSamples << multisample.sampleShadingEnable
+         << multisample.minSampleShading << multisample.alphaToCoverageEnable
+         << multisample.alphaToOneEnable;
+
+  const auto &blend = configInfo.colorBlendAttachment;
+  writer << blend.blendEnable << blend.srcColorBlendFactor
+         << blend.dstColorBlendFactor << blend.colorBlendOp
+         << blend.srcAlphaBlendFactor << blend.dstAlphaBlendFactor
+         << blend.alphaBlendOp << blend.colorWriteMask;
+
+  const auto &colorBlend = configInfo.colorBlendInfo;
+  writer << colorBlend.logicOpEnable << colorBlend.logicOp
+         << colorBlend.attachmentCount << colorBlend.blendConstants;
+
+  const auto &depthStencil = configInfo.depthStencilInfo;
+  writer << depthStencil.depthTestEnable << depthStencil.depthWriteEnable
+         << depthStencil.depthCompareOp << depthStencil.depthBoundsTestEnable
+         << depthStencil.stencilTestEnable << depthStencil.front
+         << depthStencil.back << depthStencil.minDepthBounds
+         << depthStencil.maxDepthBounds;
+
+  writer << configInfo.dynamicStateEnables.size();
+  for (auto state : configInfo.dynamicStateEnables) {
+    writer << state;
+  }
+
+  writer << configInfo.pipelineLayout << configInfo.renderPass
+         << configInfo.subpass << configInfo.colorAttachmentFormat
+         << configInfo.depthAttachmentFormat;
+
+  return writer.key;
+}
+
+} // namespace engine
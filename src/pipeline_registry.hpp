@@ -0,0 +1,154 @@
+#pragma once
+
+#include "device.hpp"
+#include "pipeline.hpp"
+#include "thread_pool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+// A pipeline compiled in the background. Until it is ready, binding it
+// binds the fallback pipeline instead. A request whose compile failed never
+// becomes ready and keeps the fallback for good.
+class AsyncPipeline {
+public:
+  AsyncPipeline(std::shared_ptr<Pipeline> fallback,
+                std::atomic<uint64_t> &fallbackBinds);
+
+  AsyncPipeline(const AsyncPipeline &) = delete;
+  AsyncPipeline &operator=(const AsyncPipeline &) = delete;
+
+  bool isReady() const { return ready.load(std::memory_order_acquire); }
+  bool isFailed() const { return failed.load(std::memory_order_acquire); }
+  void bind(VkCommandBuffer commandBuffer);
+  // The compiled pipeline once ready, the fallback until then.
+  std::shared_ptr<Pipeline> getPipeline() const {
+    return isReady() ? pipeline : fallback;
+  }
+
+private:
+  friend class PipelineRegistry;
+
+  void resolve(std::shared_ptr<Pipeline> compiled);
+  void fail() { failed.store(true, std::memory_order_release); }
+
+  std::shared_ptr<Pipeline> fallback;
+  // Written once by the compiling thread before ready is set.
+  std::shared_ptr<Pipeline> pipeline;
+  std::atomic<bool> ready{false};
+  std::atomic<bool> failed{false};
+  std::atomic<uint64_t> &fallbackBinds;
+};
+
+// Hands out shared pipelines keyed by their shaders and fixed-function
+// state, so render systems that ask for the same pipeline get the same
+// VkPipeline and it is only compiled once. Pipelines live as long as the
+// registry.
+//
+// Shaders are named by source file (e.g. "simple_shader.vert") and come
+// from the SPIR-V embedded in the binary, or from <name>.spv in the
+// override directory when one is set and has that file, for iterating on
+// shaders without rebuilding.
+//
+// Shader modules are shared between the pipelines built from them and only
+// needed while compiling; releaseShaderModules() frees them once the
+// pipelines a batch of render systems needs have been created, and they
+// are freed whenever the last background compile finishes.
+class PipelineRegistry {
+public:
+  // Synchronous compiles slower than this would have stalled a frame.
+  static constexpr float HITCH_THRESHOLD_MS = 8.f;
+  static constexpr uint32_t COMPILE_THREADS = 2;
+
+  struct Stats {
+    uint32_t requests = 0;
+    uint32_t compiled = 0;
+    uint32_t pending = 0;
+    uint32_t failed = 0;
+    // From request to ready, for background compiles.
+    float averageCompileLatencyMs = 0.f;
+    float maxCompileLatencyMs = 0.f;
+    uint32_t hitches = 0;
+    uint64_t fallbackBinds = 0;
+  };
+
+  PipelineRegistry(Device &device, const std::string &shaderOverrideDir = "");
+
+  PipelineRegistry(const PipelineRegistry &) = delete;
+  PipelineRegistry &operator=(const PipelineRegistry &) = delete;
+
+  // Compiles on the calling thread if the pipeline doesn't exist yet. An
+  // empty fragShaderName builds a vertex-only pipeline (e.g. depth-only).
+  // The pipeline layout and render pass are part of the key by handle.
+  std::shared_ptr<Pipeline> getPipeline(const std::string &vertShaderName,
+                                        const std::string &fragShaderName,
+                                        const PipelineConfigInfo &configInfo);
+
+  // Queues the pipeline to be compiled on a worker thread; draws use the
+  // fallback until it is ready. Safe to call every frame, requests for a
+  // pipeline already compiling share one compile. A pipeline that failed to
+  // compile is not retried, later requests for it come back failed.
+  std::shared_ptr<AsyncPipeline>
+  requestPipeline(const std::string &vertShaderName,
+                  const std::string &fragShaderName,
+                  const PipelineConfigInfo &configInfo,
+                  std::shared_ptr<Pipeline> fallback);
+
+  void releaseShaderModules();
+
+  Stats getStats();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct ShaderModule {
+    ShaderModule(Device &device, const uint32_t *code, size_t size);
+    ~ShaderModule();
+
+    ShaderModule(const ShaderModule &) = delete;
+    ShaderModule &operator=(const ShaderModule &) = delete;
+
+    Device &device;
+    VkShaderModule module;
+  };
+
+  static std::vector<uint32_t> readFile(const std::string &filePath);
+  static std::string makeKey(const std::string &vertShaderName,
+                             const std::string &fragShaderName,
+                             const PipelineConfigInfo &configInfo);
+
+  // Called with mutex held.
+  std::shared_ptr<ShaderModule> getShaderModule(const std::string &name);
+  std::shared_ptr<Pipeline> addPipeline(const std::string &key,
+                                        std::shared_ptr<Pipeline> pipeline);
+
+  Device &device;
+  std::string shaderOverrideDir;
+
+  std::mutex mutex;
+  std::unordered_map<std::string, std::shared_ptr<Pipeline>> pipelines;
+  std::unordered_map<std::string, std::weak_ptr<AsyncPipeline>> pending;
+  std::unordered_set<std::string> failedKeys;
+  std::unordered_map<std::string, std::shared_ptr<ShaderModule>>
+      shaderModules;
+  Stats stats;
+  float totalCompileLatencyMs = 0.f;
+  uint32_t asyncCompiled = 0;
+  std::atomic<uint64_t> fallbackBinds{0};
+
+  // Last, so it finishes queued compiles before anything else goes away.
+  ThreadPool compiler{COMPILE_THREADS};
+};
+
+} // namespace engine
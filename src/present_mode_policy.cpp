@@ -0,0 +1,39 @@
+#include "present_mode_policy.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace engine {
+
+PresentModePolicy::PresentModePolicy(float budgetMs,
+                                     SwapChain::PresentMode lateMode)
+    : budgetMs{budgetMs}, lateMode{lateMode} {
+  if (budgetMs <= 0.f) {
+    throw std::runtime_error("Frame budget must be positive");
+  }
+}
+
+SwapChain::PresentMode PresentModePolicy::update(float frameCostMs) {
+  frameCount++;
+  if (frameCostMs > budgetMs) {
+    lateFrameCount++;
+  }
+  worstFrameMs = std::max(worstFrameMs, frameCostMs);
+
+  if (frameCount < WINDOW_FRAMES) {
+    return presentMode;
+  }
+
+  if (lateFrameCount > WINDOW_FRAMES * LATE_FRACTION) {
+    presentMode = lateMode;
+  } else if (worstFrameMs < budgetMs * COMFORTABLE_RATIO) {
+    presentMode = SwapChain::FIFO;
+  }
+
+  frameCount = 0;
+  lateFrameCount = 0;
+  worstFrameMs = 0.f;
+  return presentMode;
+}
+
+} // namespace engine
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "swapchain.hpp"
+
+#include <cstdint>
+
+namespace engine {
+
+// Adaptive vsync: switches to a non-blocking late mode (FIFO_RELAXED or
+// MAILBOX) when frames regularly miss the refresh budget, so a late frame
+// is shown immediately instead of waiting a whole extra refresh, and back
+// to FIFO once they comfortably fit again. Decisions are made once per
+// window of frames with a gap between the two thresholds, so the swap
+// chain isn't rebuilt back and forth.
+class PresentModePolicy {
+public:
+  PresentModePolicy(float budgetMs, SwapChain::PresentMode lateMode);
+
+  PresentModePolicy(const PresentModePolicy &) = delete;
+  PresentModePolicy &operator=(const PresentModePolicy &) = delete;
+
+  // frameCostMs is the work a frame took, independent of present blocking,
+  // e.g. the larger of its CPU recording time and GPU time. Returns the
+  // mode the swap chain should use.
+  SwapChain::PresentMode update(float frameCostMs);
+
+  SwapChain::PresentMode getPresentMode() const { return presentMode; }
+
+private:
+  static constexpr uint32_t WINDOW_FRAMES = 60;
+  // Share of late frames in a window that switches to the late mode.
+  static constexpr float LATE_FRACTION = 0.1f;
+  // Back to FIFO once the worst frame of a window fits in this share of
+  // the budget.
+  static constexpr float COMFORTABLE_RATIO = 0.8f;
+
+  float budgetMs;
+  SwapChain::PresentMode lateMode;
+  SwapChain::PresentMode presentMode = SwapChain::FIFO;
+
+  uint32_t frameCount = 0;
+  uint32_t lateFrameCount = 0;
+  float worstFrameMs = 0.f;
+};
+
+} // namespace engine
@@ -0,0 +1,968 @@
+#include "render_graph.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <stdexcept>
+
+namespace engine {
+
+void RenderGraph::PassBuilder::colorAttachment(ResourceId image,
+                                               LoadOp loadOp,
+                                               VkClearColorValue clearValue) {
+  VkClearValue value{};
+  value.color = clearValue;
+  graph.addAccess(passIndex,
+                  {image, AccessType::ColorAttachment, loadOp, value});
+}
+
+void RenderGraph::PassBuilder::depthAttachment(
+    ResourceId image, LoadOp loadOp, bool writeDepth,
+    VkClearDepthStencilValue clearValue) {
+  VkClearValue value{};
+  value.depthStencil = clearValue;
+  graph.addAccess(passIndex, {image,
+                              writeDepth ? AccessType::DepthAttachment
+                                         : AccessType::DepthAttachmentReadOnly,
+                              loadOp, value});
+}
+
+void RenderGraph::PassBuilder::transferSource(ResourceId image) {
+  graph.addAccess(passIndex,
+                  {image, AccessType::TransferSource, LoadOp::Load, {}});
+}
+
+void RenderGraph::PassBuilder::transferDestination(ResourceId image) {
+  graph.addAccess(passIndex, {image, AccessType::TransferDestination,
+                              LoadOp::DontCare, {}});
+}
+
+void RenderGraph::PassBuilder::useSecondaryCommandBuffers() {
+  graph.passes[passIndex].secondaryCommandBuffers = true;
+}
+
+void RenderGraph::PassBuilder::hasSideEffects() {
+  graph.passes[passIndex].sideEffects = true;
+}
+
+RenderGraph::RenderGraph(Device &device) : device{device} {}
+
+RenderGraph::~RenderGraph() { destroyCompiled(); }
+
+void RenderGraph::reset() {
+  passes.clear();
+  resources.clear();
+}
+
+RenderGraph::ResourceId RenderGraph::importImage(
+    const std::string &name, VkImage image, VkImageView view,
+    const ImageDesc &desc, VkImageLayout initialLayout,
+    VkImageLayout finalLayout, VkPipelineStageFlags initialStage,
+    uint64_t version) {
+  ResourceDecl resource{};
+  resource.name = name;
+  resource.desc = desc;
+  resource.imported = true;
+  resource.image = image;
+  resource.view = view;
+  resource.initialLayout = initialLayout;
+  resource.finalLayout = finalLayout;
+  resource.initialStage = initialStage;
+  resource.version = version;
+  resources.push_back(resource);
+  return static_cast<ResourceId>(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::createImage(const std::string &name,
+                                                 const ImageDesc &desc) {
+  ResourceDecl resource{};
+  resource.name = name;
+  resource.desc = desc;
+  resources.push_back(resource);
+  return static_cast<ResourceId>(resources.size() - 1);
+}
+
+void RenderGraph::addPass(const std::string &name, const SetupFn &setup,
+                          ExecuteFn execute) {
+  PassDecl pass{};
+  pass.name = name;
+  pass.execute = std::move(execute);
+  passes.push_back(std::move(pass));
+
+  PassBuilder builder{*this, static_cast<uint32_t>(passes.size() - 1)};
+  setup(builder);
+}
+
+void RenderGraph::markOutput(ResourceId image) {
+  assert(image < resources.size() && "Unknown render graph resource");
+  resources[image].output = true;
+}
+
+void RenderGraph::addAccess(uint32_t passIndex, const ResourceAccess &access) {
+  assert(access.resource < resources.size() &&
+         "Unknown render graph resource");
+  for (const auto &existing : passes[passIndex].accesses) {
+    assert(existing.resource != access.resource &&
+           "A pass may access each resource only once");
+  }
+  passes[passIndex].accesses.push_back(access);
+}
+
+VkImage RenderGraph::getImage(ResourceId image) const {
+  if (resources[image].imported) {
+    return resources[image].image;
+  }
+  return transientImages[image].image;
+}
+
+VkImageView RenderGraph::getImageView(ResourceId image) const {
+  if (resources[image].imported) {
+    return resources[image].view;
+  }
+  return transientImages[image].view;
+}
+
+const RenderGraph::ImageDesc &
+RenderGraph::getImageDesc(ResourceId image) const {
+  return resources[image].desc;
+}
+
+bool RenderGraph::isWrite(AccessType type) {
+  return type == AccessType::ColorAttachment ||
+         type == AccessType::DepthAttachment ||
+         type == AccessType::TransferDestination;
+}
+
+bool RenderGraph::isAttachment(AccessType type) {
+  return type == AccessType::ColorAttachment ||
+         type == AccessType::DepthAttachment ||
+         type == AccessType::DepthAttachmentReadOnly;
+}
+
+VkAttachmentLoadOp RenderGraph::attachmentLoadOp(LoadOp loadOp) {
+  switch (loadOp) {
+  case LoadOp::Load:
+    return VK_ATTACHMENT_LOAD_OP_LOAD;
+  case LoadOp::Clear:
+    return VK_ATTACHMENT_LOAD_OP_CLEAR;
+  case LoadOp::DontCare:
+    return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  }
+  return VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+}
+
+bool RenderGraph::needsPreviousContents(const ResourceAccess &access) {
+  return access.type == AccessType::TransferSource ||
+         access.type == AccessType::DepthAttachmentReadOnly ||
+         access.loadOp == LoadOp::Load;
+}
+
+VkImageLayout RenderGraph::layoutFor(AccessType type) {
+  switch (type) {
+  case AccessType::ColorAttachment:
+    return VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  case AccessType::DepthAttachment:
+  case AccessType::DepthAttachmentReadOnly:
+    // Read-only depth stays in the attachment layout so that a depth
+    // pre-pass followed by an EQUAL pass needs no layout transition.
+    return VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  case AccessType::TransferSource:
+    return VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  case AccessType::TransferDestination:
+    return VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  }
+  return VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+VkPipelineStageFlags RenderGraph::stagesFor(AccessType type) {
+  switch (type) {
+  case AccessType::ColorAttachment:
+    return VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  case AccessType::DepthAttachment:
+  case AccessType::DepthAttachmentReadOnly:
+    return VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  case AccessType::TransferSource:
+  case AccessType::TransferDestination:
+    return VK_PIPELINE_STAGE_TRANSFER_BIT;
+  }
+  return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+}
+
+VkAccessFlags RenderGraph::accessesFor(const ResourceAccess &access) {
+  switch (access.type) {
+  case AccessType::ColorAttachment:
+    return VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+           (access.loadOp == LoadOp::Load ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+                                          : 0);
+  case AccessType::DepthAttachment:
+    return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  case AccessType::DepthAttachmentReadOnly:
+    return VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+  case AccessType::TransferSource:
+    return VK_ACCESS_TRANSFER_READ_BIT;
+  case AccessType::TransferDestination:
+    return VK_ACCESS_TRANSFER_WRITE_BIT;
+  }
+  return 0;
+}
+
+VkImageUsageFlags RenderGraph::usageFor(AccessType type) {
+  switch (type) {
+  case AccessType::ColorAttachment:
+    return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  case AccessType::DepthAttachment:
+  case AccessType::DepthAttachmentReadOnly:
+    return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  case AccessType::TransferSource:
+    return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  case AccessType::TransferDestination:
+    return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+  return 0;
+}
+
+VkImageAspectFlags RenderGraph::aspectFor(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  case VK_FORMAT_S8_UINT:
+    return VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+size_t RenderGraph::topologyHash() const {
+  size_t seed = 0;
+  for (const auto &resource : resources) {
+    hashCombine(seed, resource.name, static_cast<int>(resource.desc.format),
+                resource.desc.extent.width, resource.desc.extent.height,
+                resource.imported, resource.output,
+                static_cast<int>(resource.initialLayout),
+                static_cast<int>(resource.finalLayout), resource.initialStage,
+                resource.version);
+  }
+  for (const auto &pass : passes) {
+    hashCombine(seed, pass.name, pass.secondaryCommandBuffers,
+                pass.sideEffects);
+    for (const auto &access : pass.accesses) {
+      hashCombine(seed, access.resource, static_cast<int>(access.type),
+                  static_cast<int>(access.loadOp));
+    }
+  }
+  return seed;
+}
+
+// Compares the fields topologyHash() covers, so a hash collision can't reuse
+// another graph's render passes, barriers and images.
+bool RenderGraph::matchesCompiled() const {
+  auto sameResource = [](const ResourceDecl &a, const ResourceDecl &b) {
+    return a.name == b.name && a.desc.format == b.desc.format &&
+           a.desc.extent.width == b.desc.extent.width &&
+           a.desc.extent.height == b.desc.extent.height &&
+           a.imported == b.imported && a.output == b.output &&
+           a.initialLayout == b.initialLayout &&
+           a.finalLayout == b.finalLayout &&
+           a.initialStage == b.initialStage && a.version == b.version;
+  };
+  auto sameAccess = [](const ResourceAccess &a, const ResourceAccess &b) {
+    return a.resource == b.resource && a.type == b.type &&
+           a.loadOp == b.loadOp;
+  };
+  auto samePass = [&](const PassDecl &a, const PassDecl &b) {
+    return a.name == b.name &&
+           a.secondaryCommandBuffers == b.secondaryCommandBuffers &&
+           a.sideEffects == b.sideEffects &&
+           std::equal(a.accesses.begin(), a.accesses.end(),
+                      b.accesses.begin(), b.accesses.end(), sameAccess);
+  };
+  return std::equal(resources.begin(), resources.end(),
+                    compiledResourceDecls.begin(), compiledResourceDecls.end(),
+                    sameResource) &&
+         std::equal(passes.begin(), passes.end(), compiledPassDecls.begin(),
+                    compiledPassDecls.end(), samePass);
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+  // The hash rejects changed graphs cheaply; only a match is compared in
+  // full.
+  size_t hash = topologyHash();
+  if (!compiled || hash != compiledHash || !matchesCompiled()) {
+    destroyCompiled();
+    compile();
+    compiledHash = hash;
+    compiledResourceDecls = resources;
+    compiledPassDecls = passes;
+    // Callbacks may refer to the frame that declared them.
+    for (auto &pass : compiledPassDecls) {
+      pass.execute = nullptr;
+    }
+  } else {
+    readPassTimings();
+  }
+
+  if (timestampQueryPool != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(commandBuffer, timestampQueryPool, 0,
+                        static_cast<uint32_t>(compiledPasses.size() * 2));
+  }
+
+  for (uint32_t i = 0; i < compiledPasses.size(); i++) {
+    auto &compiledPass = compiledPasses[i];
+    auto &pass = passes[compiledPass.passIndex];
+
+    recordBarriers(commandBuffer, compiledPass.barriers);
+
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          timestampQueryPool, i * 2);
+    }
+
+    PassContext context{};
+    if (!compiledPass.attachments.empty()) {
+      context.extent = resources[compiledPass.attachments[0]].desc.extent;
+      context.colorAttachmentCount =
+          static_cast<uint32_t>(compiledPass.colorFormats.size());
+      context.colorFormats = compiledPass.colorFormats.data();
+      context.depthFormat = compiledPass.depthFormat;
+
+      if (compiledPass.renderPass != VK_NULL_HANDLE) {
+        context.renderPass = compiledPass.renderPass;
+        context.framebuffer = getFramebuffer(compiledPass);
+
+        std::vector<VkClearValue> clearValues;
+        for (const auto &access : pass.accesses) {
+          if (isAttachment(access.type)) {
+            clearValues.push_back(access.clearValue);
+          }
+        }
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = context.renderPass;
+        renderPassInfo.framebuffer = context.framebuffer;
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = context.extent;
+        renderPassInfo.clearValueCount =
+            static_cast<uint32_t>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+
+        vkCmdBeginRenderPass(
+            commandBuffer, &renderPassInfo,
+            pass.secondaryCommandBuffers
+                ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                : VK_SUBPASS_CONTENTS_INLINE);
+      } else {
+        beginRendering(commandBuffer, compiledPass, pass, context.extent);
+      }
+
+      if (!pass.secondaryCommandBuffers) {
+        VkViewport viewport{0.f,
+                            0.f,
+                            static_cast<float>(context.extent.width),
+                            static_cast<float>(context.extent.height),
+                            0.f,
+                            1.f};
+        VkRect2D scissor{{0, 0}, context.extent};
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+      }
+
+      pass.execute(commandBuffer, context);
+      if (compiledPass.renderPass != VK_NULL_HANDLE) {
+        vkCmdEndRenderPass(commandBuffer);
+      } else {
+        device.cmdEndRendering(commandBuffer);
+      }
+    } else {
+      pass.execute(commandBuffer, context);
+    }
+
+    if (timestampQueryPool != VK_NULL_HANDLE) {
+      vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                          timestampQueryPool, i * 2 + 1);
+    }
+  }
+
+  recordBarriers(commandBuffer, finalBarriers);
+  timestampsPending = timestampQueryPool != VK_NULL_HANDLE;
+}
+
+void RenderGraph::compile() {
+  std::vector<uint32_t> livePasses;
+  cullPasses(livePasses);
+  culledPassCount = static_cast<uint32_t>(passes.size() - livePasses.size());
+
+  compiledPasses.resize(livePasses.size());
+  for (size_t i = 0; i < livePasses.size(); i++) {
+    compiledPasses[i].passIndex = livePasses[i];
+  }
+
+  createTransientImages(livePasses);
+  computeBarriers(livePasses);
+
+  for (uint32_t i = 0; i < compiledPasses.size(); i++) {
+    collectAttachments(compiledPasses[i], i);
+    if (!compiledPasses[i].attachments.empty() &&
+        !device.supportsDynamicRendering()) {
+      createRenderPass(compiledPasses[i]);
+    }
+  }
+
+  createTimestampQueryPool();
+
+  compiled = true;
+  rebuildCount++;
+}
+
+// Walks passes backwards from the graph outputs. A pass survives if it has
+// side effects or writes a resource whose current contents are still needed
+// by a later surviving pass (or are an output).
+void RenderGraph::cullPasses(std::vector<uint32_t> &livePasses) const {
+  std::vector<bool> needed(resources.size(), false);
+  for (size_t i = 0; i < resources.size(); i++) {
+    needed[i] = resources[i].output;
+  }
+
+  std::vector<bool> live(passes.size(), false);
+  for (size_t i = passes.size(); i-- > 0;) {
+    const auto &pass = passes[i];
+
+    bool isLive = pass.sideEffects;
+    for (const auto &access : pass.accesses) {
+      if (isWrite(access.type) && needed[access.resource]) {
+        isLive = true;
+      }
+    }
+    if (!isLive) {
+      continue;
+    }
+    live[i] = true;
+
+    for (const auto &access : pass.accesses) {
+      if (isWrite(access.type) && !needsPreviousContents(access)) {
+        needed[access.resource] = false;
+      }
+    }
+    for (const auto &access : pass.accesses) {
+      if (needsPreviousContents(access)) {
+        needed[access.resource] = true;
+      }
+    }
+  }
+
+  for (uint32_t i = 0; i < passes.size(); i++) {
+    if (live[i]) {
+      livePasses.push_back(i);
+    }
+  }
+}
+
+// Transient images are placed greedily, in order of first use, into the
+// first memory block whose previous occupant is dead by then.
+void RenderGraph::createTransientImages(
+    const std::vector<uint32_t> &livePasses) {
+  transientImages.assign(resources.size(), TransientImage{});
+  aliasedImageCount = 0;
+
+  std::vector<bool> used(resources.size(), false);
+  for (uint32_t position = 0; position < livePasses.size(); position++) {
+    for (const auto &access : passes[livePasses[position]].accesses) {
+      auto &transient = transientImages[access.resource];
+      if (!used[access.resource]) {
+        transient.firstUse = position;
+        used[access.resource] = true;
+      }
+      transient.lastUse = position;
+      transient.usage |= usageFor(access.type);
+    }
+  }
+
+  std::vector<ResourceId> order;
+  for (ResourceId i = 0; i < resources.size(); i++) {
+    if (!resources[i].imported && used[i]) {
+      order.push_back(i);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [this](ResourceId a, ResourceId b) {
+                     return transientImages[a].firstUse <
+                            transientImages[b].firstUse;
+                   });
+
+  std::vector<uint32_t> imageBlocks(resources.size(), 0);
+  for (ResourceId id : order) {
+    auto &transient = transientImages[id];
+    const auto &desc = resources[id].desc;
+
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = desc.extent.width;
+    imageInfo.extent.height = desc.extent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = desc.format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = transient.usage;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateImage(device.device(), &imageInfo, nullptr,
+                      &transient.image) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create render graph image");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device.device(), transient.image,
+                                 &memRequirements);
+
+    uint32_t blockIndex = static_cast<uint32_t>(memoryBlocks.size());
+    for (uint32_t i = 0; i < memoryBlocks.size(); i++) {
+      if (memoryBlocks[i].lastUse < transient.firstUse &&
+          (memoryBlocks[i].memoryTypeBits & memRequirements.memoryTypeBits)) {
+        blockIndex = i;
+        break;
+      }
+    }
+
+    if (blockIndex == memoryBlocks.size()) {
+      memoryBlocks.emplace_back();
+    } else {
+      transient.aliasPredecessor =
+          static_cast<int32_t>(memoryBlocks[blockIndex].lastOccupant);
+      aliasedImageCount++;
+    }
+
+    auto &block = memoryBlocks[blockIndex];
+    block.size = std::max(block.size, memRequirements.size);
+    block.memoryTypeBits &= memRequirements.memoryTypeBits;
+    block.lastUse = transient.lastUse;
+    block.lastOccupant = id;
+    imageBlocks[id] = blockIndex;
+  }
+
+  for (auto &block : memoryBlocks) {
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = block.size;
+    allocInfo.memoryTypeIndex = device.findMemoryType(
+        block.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (vkAllocateMemory(device.device(), &allocInfo, nullptr,
+                         &block.memory) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate render graph memory");
+    }
+  }
+
+  for (ResourceId id : order) {
+    auto &transient = transientImages[id];
+    const auto &desc = resources[id].desc;
+
+    if (vkBindImageMemory(device.device(), transient.image,
+                          memoryBlocks[imageBlocks[id]].memory,
+                          0) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to bind render graph image memory");
+    }
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = transient.image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = desc.format;
+    viewInfo.subresourceRange.aspectMask = aspectFor(desc.format);
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(device.device(), &viewInfo, nullptr,
+                          &transient.view) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create render graph image view");
+    }
+  }
+}
+
+// Simulates the state of every image across the surviving passes and emits
+// a barrier only where a layout changes or a hazard exists. Reads following
+// reads in the same layout are merged without a barrier.
+void RenderGraph::computeBarriers(const std::vector<uint32_t> &livePasses) {
+  std::vector<ResourceState> states(resources.size());
+  std::vector<bool> touched(resources.size(), false);
+
+  for (uint32_t position = 0; position < livePasses.size(); position++) {
+    auto &batch = compiledPasses[position].barriers;
+
+    for (const auto &access : passes[livePasses[position]].accesses) {
+      ResourceId id = access.resource;
+      if (!touched[id]) {
+        touched[id] = true;
+        const auto &resource = resources[id];
+        if (resource.imported) {
+          states[id].layout = resource.initialLayout;
+          states[id].stages = resource.initialStage;
+        } else if (transientImages[id].aliasPredecessor >= 0) {
+          // Memory reuse: wait for the previous occupant's accesses, but
+          // its contents are meaningless to us.
+          states[id] = states[transientImages[id].aliasPredecessor];
+          states[id].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+      }
+
+      auto &state = states[id];
+      VkImageLayout newLayout = layoutFor(access.type);
+      VkPipelineStageFlags stages = stagesFor(access.type);
+      VkAccessFlags accesses = accessesFor(access);
+      bool write = isWrite(access.type);
+
+      if (state.layout != newLayout || state.written || write) {
+        BarrierTemplate barrier{};
+        barrier.resource = id;
+        barrier.oldLayout = needsPreviousContents(access)
+                                ? state.layout
+                                : VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = newLayout;
+        barrier.srcAccessMask = state.written ? state.accesses : 0;
+        barrier.dstAccessMask = accesses;
+        batch.barriers.push_back(barrier);
+
+        batch.srcStageMask |=
+            state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        batch.dstStageMask |= stages;
+
+        state.layout = newLayout;
+        state.stages = stages;
+        state.accesses = accesses;
+        state.written = write;
+      } else {
+        state.stages |= stages;
+        state.accesses |= accesses;
+      }
+    }
+  }
+
+  for (ResourceId id = 0; id < resources.size(); id++) {
+    const auto &resource = resources[id];
+    if (!resource.imported || !touched[id] ||
+        resource.finalLayout == VK_IMAGE_LAYOUT_UNDEFINED) {
+      continue;
+    }
+
+    const auto &state = states[id];
+    BarrierTemplate barrier{};
+    barrier.resource = id;
+    barrier.oldLayout = state.layout;
+    barrier.newLayout = resource.finalLayout;
+    barrier.srcAccessMask = state.written ? state.accesses : 0;
+    barrier.dstAccessMask = 0;
+    finalBarriers.barriers.push_back(barrier);
+
+    finalBarriers.srcStageMask |=
+        state.stages ? state.stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    finalBarriers.dstStageMask |= VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  }
+}
+
+VkAttachmentStoreOp RenderGraph::storeOpFor(uint32_t livePosition,
+                                            ResourceId resource) const {
+  for (uint32_t i = livePosition + 1; i < compiledPasses.size(); i++) {
+    for (const auto &access : passes[compiledPasses[i].passIndex].accesses) {
+      if (access.resource == resource) {
+        return needsPreviousContents(access) ? VK_ATTACHMENT_STORE_OP_STORE
+                                             : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      }
+    }
+  }
+
+  const auto &decl = resources[resource];
+  return decl.imported || decl.output ? VK_ATTACHMENT_STORE_OP_STORE
+                                      : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+}
+
+// Layouts are handled by the graph's barriers, so each render pass starts
+// and ends in the layout its subpass uses and needs no external
+// dependencies.
+void RenderGraph::collectAttachments(CompiledPass &compiledPass,
+                                     uint32_t livePosition) {
+  const auto &pass = passes[compiledPass.passIndex];
+
+  for (const auto &access : pass.accesses) {
+    if (!isAttachment(access.type)) {
+      continue;
+    }
+
+    compiledPass.attachments.push_back(access.resource);
+    compiledPass.storeOps.push_back(storeOpFor(livePosition, access.resource));
+    VkFormat format = resources[access.resource].desc.format;
+    if (access.type == AccessType::ColorAttachment) {
+      compiledPass.colorFormats.push_back(format);
+    } else {
+      assert(compiledPass.depthFormat == VK_FORMAT_UNDEFINED &&
+             "A pass may have only one depth attachment");
+      compiledPass.depthFormat = format;
+    }
+  }
+}
+
+void RenderGraph::createRenderPass(CompiledPass &compiledPass) {
+  const auto &pass = passes[compiledPass.passIndex];
+
+  std::vector<VkAttachmentDescription> attachments;
+  std::vector<VkAttachmentReference> colorRefs;
+  VkAttachmentReference depthRef{};
+  bool hasDepth = false;
+
+  for (const auto &access : pass.accesses) {
+    if (!isAttachment(access.type)) {
+      continue;
+    }
+
+    VkImageLayout layout = layoutFor(access.type);
+    VkAttachmentDescription attachment{};
+    attachment.format = resources[access.resource].desc.format;
+    attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    attachment.loadOp = attachmentLoadOp(access.loadOp);
+    attachment.storeOp = compiledPass.storeOps[attachments.size()];
+    attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    attachment.initialLayout = layout;
+    attachment.finalLayout = layout;
+
+    VkAttachmentReference ref{};
+    ref.attachment = static_cast<uint32_t>(attachments.size());
+    ref.layout = layout;
+    if (access.type == AccessType::ColorAttachment) {
+      colorRefs.push_back(ref);
+    } else {
+      depthRef = ref;
+      hasDepth = true;
+    }
+
+    attachments.push_back(attachment);
+  }
+
+  VkSubpassDescription subpass = {};
+  subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+  subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+  subpass.pColorAttachments = colorRefs.data();
+  subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+  VkRenderPassCreateInfo renderPassInfo = {};
+  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+  renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+  renderPassInfo.pAttachments = attachments.data();
+  renderPassInfo.subpassCount = 1;
+  renderPassInfo.pSubpasses = &subpass;
+
+  if (vkCreateRenderPass(device.device(), &renderPassInfo, nullptr,
+                         &compiledPass.renderPass) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create render graph render pass");
+  }
+}
+
+// Layouts are handled by the pass barriers, exactly as with the render
+// passes, whose attachments start and end in the layout they are used in.
+void RenderGraph::beginRendering(VkCommandBuffer commandBuffer,
+                                 const CompiledPass &compiledPass,
+                                 const PassDecl &pass, VkExtent2D extent) {
+  std::vector<VkRenderingAttachmentInfoKHR> colorAttachments;
+  VkRenderingAttachmentInfoKHR depthAttachment{};
+  bool hasDepth = false;
+
+  size_t attachmentIndex = 0;
+  for (const auto &access : pass.accesses) {
+    if (!isAttachment(access.type)) {
+      continue;
+    }
+
+    VkRenderingAttachmentInfoKHR attachment{};
+    attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    attachment.imageView = getImageView(access.resource);
+    attachment.imageLayout = layoutFor(access.type);
+    attachment.resolveMode = VK_RESOLVE_MODE_NONE;
+    attachment.loadOp = attachmentLoadOp(access.loadOp);
+    attachment.storeOp = compiledPass.storeOps[attachmentIndex++];
+    attachment.clearValue = access.clearValue;
+
+    if (access.type == AccessType::ColorAttachment) {
+      colorAttachments.push_back(attachment);
+    } else {
+      depthAttachment = attachment;
+      hasDepth = true;
+    }
+  }
+
+  VkRenderingInfoKHR renderingInfo{};
+  renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+  renderingInfo.flags =
+      pass.secondaryCommandBuffers
+          ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR
+          : 0;
+  renderingInfo.renderArea.offset = {0, 0};
+  renderingInfo.renderArea.extent = extent;
+  renderingInfo.layerCount = 1;
+  renderingInfo.colorAttachmentCount =
+      static_cast<uint32_t>(colorAttachments.size());
+  renderingInfo.pColorAttachments = colorAttachments.data();
+  renderingInfo.pDepthAttachment = hasDepth ? &depthAttachment : nullptr;
+
+  device.cmdBeginRendering(commandBuffer, renderingInfo);
+}
+
+VkFramebuffer RenderGraph::getFramebuffer(CompiledPass &compiledPass) {
+  std::vector<VkImageView> views;
+  for (ResourceId id : compiledPass.attachments) {
+    views.push_back(getImageView(id));
+  }
+
+  auto it = compiledPass.framebuffers.find(views);
+  if (it != compiledPass.framebuffers.end()) {
+    return it->second;
+  }
+
+  const auto &extent = resources[compiledPass.attachments[0]].desc.extent;
+
+  VkFramebufferCreateInfo framebufferInfo = {};
+  framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  framebufferInfo.renderPass = compiledPass.renderPass;
+  framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+  framebufferInfo.pAttachments = views.data();
+  framebufferInfo.width = extent.width;
+  framebufferInfo.height = extent.height;
+  framebufferInfo.layers = 1;
+
+  VkFramebuffer framebuffer;
+  if (vkCreateFramebuffer(device.device(), &framebufferInfo, nullptr,
+                          &framebuffer) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create render graph framebuffer");
+  }
+
+  compiledPass.framebuffers.emplace(std::move(views), framebuffer);
+  return framebuffer;
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer,
+                                 const BarrierBatch &batch) const {
+  if (batch.barriers.empty()) {
+    return;
+  }
+
+  std::vector<VkImageMemoryBarrier> imageBarriers;
+  imageBarriers.reserve(batch.barriers.size());
+  for (const auto &barrier : batch.barriers) {
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = barrier.srcAccessMask;
+    imageBarrier.dstAccessMask = barrier.dstAccessMask;
+    imageBarrier.oldLayout = barrier.oldLayout;
+    imageBarrier.newLayout = barrier.newLayout;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = getImage(barrier.resource);
+    imageBarrier.subresourceRange.aspectMask =
+        aspectFor(resources[barrier.resource].desc.format);
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+    imageBarriers.push_back(imageBarrier);
+  }
+
+  vkCmdPipelineBarrier(commandBuffer, batch.srcStageMask, batch.dstStageMask,
+                       0, 0, nullptr, 0, nullptr,
+                       static_cast<uint32_t>(imageBarriers.size()),
+                       imageBarriers.data());
+}
+
+void RenderGraph::createTimestampQueryPool() {
+  if (!device.properties.limits.timestampComputeAndGraphics ||
+      compiledPasses.empty()) {
+    return;
+  }
+
+  VkQueryPoolCreateInfo queryPoolInfo{};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolInfo.queryCount = static_cast<uint32_t>(compiledPasses.size() * 2);
+
+  if (vkCreateQueryPool(device.device(), &queryPoolInfo, nullptr,
+                        &timestampQueryPool) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create timestamp query pool");
+  }
+}
+
+void RenderGraph::readPassTimings() {
+  if (!timestampsPending) {
+    return;
+  }
+  timestampsPending = false;
+
+  std::vector<uint64_t> timestamps(compiledPasses.size() * 2);
+  auto result = vkGetQueryPoolResults(
+      device.device(), timestampQueryPool, 0,
+      static_cast<uint32_t>(timestamps.size()),
+      timestamps.size() * sizeof(uint64_t), timestamps.data(),
+      sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS) {
+    return;
+  }
+
+  passTimings.resize(compiledPasses.size());
+  for (size_t i = 0; i < compiledPasses.size(); i++) {
+    double nanoseconds =
+        static_cast<double>(timestamps[i * 2 + 1] - timestamps[i * 2]) *
+        device.properties.limits.timestampPeriod;
+    passTimings[i].name = passes[compiledPasses[i].passIndex].name;
+    passTimings[i].gpuMs = static_cast<float>(nanoseconds / 1e6);
+  }
+}
+
+void RenderGraph::destroyCompiled() {
+  for (auto &compiledPass : compiledPasses) {
+    for (auto &kv : compiledPass.framebuffers) {
+      vkDestroyFramebuffer(device.device(), kv.second, nullptr);
+    }
+    if (compiledPass.renderPass != VK_NULL_HANDLE) {
+      vkDestroyRenderPass(device.device(), compiledPass.renderPass, nullptr);
+    }
+  }
+  compiledPasses.clear();
+
+  for (auto &transient : transientImages) {
+    if (transient.view != VK_NULL_HANDLE) {
+      vkDestroyImageView(device.device(), transient.view, nullptr);
+    }
+    if (transient.image != VK_NULL_HANDLE) {
+      vkDestroyImage(device.device(), transient.image, nullptr);
+    }
+  }
+  transientImages.clear();
+
+  for (auto &block : memoryBlocks) {
+    vkFreeMemory(device.device(), block.memory, nullptr);
+  }
+  memoryBlocks.clear();
+
+  finalBarriers = BarrierBatch{};
+
+  if (timestampQueryPool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(device.device(), timestampQueryPool, nullptr);
+    timestampQueryPool = VK_NULL_HANDLE;
+  }
+  timestampsPending = false;
+  passTimings.clear();
+
+  compiled = false;
+}
+
+} // namespace engine
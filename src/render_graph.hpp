@@ -0,0 +1,265 @@
+#pragma once
+
+#include "device.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+// Per-frame description of passes and the images they touch. Passes are
+// declared every frame in execution order; the graph culls passes whose
+// results are never consumed, derives load/store ops and the image barriers
+// between passes, and lets transient images whose lifetimes don't overlap
+// share memory.
+//
+// Compiled state (render passes, framebuffers, transient images) is only
+// rebuilt when the declared topology changes. With dynamic rendering there
+// are no render passes or framebuffers: passes begin rendering directly on
+// the image views.
+//
+// A graph must not be shared between frames in flight: it destroys its
+// previous compiled state on rebuild, which is only safe once its previous
+// submission has completed.
+class RenderGraph {
+public:
+  using ResourceId = uint32_t;
+
+  enum class LoadOp { Load, Clear, DontCare };
+
+  struct ImageDesc {
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkExtent2D extent{};
+  };
+
+  // For passes with attachments. With dynamic rendering renderPass and
+  // framebuffer are null and secondary command buffers inherit the
+  // attachment formats instead.
+  struct PassContext {
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    VkExtent2D extent{};
+    uint32_t colorAttachmentCount = 0;
+    const VkFormat *colorFormats = nullptr;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+  };
+
+  struct PassTiming {
+    std::string name;
+    float gpuMs;
+  };
+
+  class PassBuilder {
+  public:
+    void colorAttachment(ResourceId image, LoadOp loadOp,
+                         VkClearColorValue clearValue = {});
+    void depthAttachment(ResourceId image, LoadOp loadOp,
+                         bool writeDepth = true,
+                         VkClearDepthStencilValue clearValue = {1.f, 0});
+    void transferSource(ResourceId image);
+    void transferDestination(ResourceId image);
+
+    // The pass is begun with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+    void useSecondaryCommandBuffers();
+    // The pass is never culled, e.g. because it writes to host memory.
+    void hasSideEffects();
+
+  private:
+    friend class RenderGraph;
+    PassBuilder(RenderGraph &graph, uint32_t passIndex)
+        : graph{graph}, passIndex{passIndex} {}
+
+    RenderGraph &graph;
+    uint32_t passIndex;
+  };
+
+  using SetupFn = std::function<void(PassBuilder &builder)>;
+  using ExecuteFn = std::function<void(VkCommandBuffer commandBuffer,
+                                       const PassContext &context)>;
+
+  RenderGraph(Device &device);
+  ~RenderGraph();
+
+  RenderGraph(const RenderGraph &) = delete;
+  RenderGraph &operator=(const RenderGraph &) = delete;
+
+  // Drops the declarations of the previous frame. Compiled state is kept.
+  void reset();
+
+  // version identifies the external image set (e.g. a swap chain
+  // generation); changing it forces a rebuild of everything that
+  // references the image.
+  ResourceId importImage(const std::string &name, VkImage image,
+                         VkImageView view, const ImageDesc &desc,
+                         VkImageLayout initialLayout,
+                         VkImageLayout finalLayout,
+                         VkPipelineStageFlags initialStage, uint64_t version);
+  ResourceId createImage(const std::string &name, const ImageDesc &desc);
+
+  void addPass(const std::string &name, const SetupFn &setup,
+               ExecuteFn execute);
+  void markOutput(ResourceId image);
+
+  void execute(VkCommandBuffer commandBuffer);
+
+  VkImage getImage(ResourceId image) const;
+  VkImageView getImageView(ResourceId image) const;
+  const ImageDesc &getImageDesc(ResourceId image) const;
+
+  // GPU time per executed pass, from this graph's previous execution.
+  const std::vector<PassTiming> &getPassTimings() const { return passTimings; }
+  uint32_t getCulledPassCount() const { return culledPassCount; }
+  uint32_t getAliasedImageCount() const { return aliasedImageCount; }
+  uint64_t getRebuildCount() const { return rebuildCount; }
+
+private:
+  enum class AccessType {
+    ColorAttachment,
+    DepthAttachment,
+    DepthAttachmentReadOnly,
+    TransferSource,
+    TransferDestination
+  };
+
+  struct ResourceAccess {
+    ResourceId resource;
+    AccessType type;
+    LoadOp loadOp;
+    VkClearValue clearValue;
+  };
+
+  struct PassDecl {
+    std::string name;
+    std::vector<ResourceAccess> accesses;
+    ExecuteFn execute;
+    bool secondaryCommandBuffers = false;
+    bool sideEffects = false;
+  };
+
+  struct ResourceDecl {
+    std::string name;
+    ImageDesc desc;
+    bool imported = false;
+    bool output = false;
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkImageLayout initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageLayout finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags initialStage = 0;
+    uint64_t version = 0;
+  };
+
+  struct ResourceState {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags stages = 0;
+    VkAccessFlags accesses = 0;
+    bool written = false;
+  };
+
+  struct BarrierTemplate {
+    ResourceId resource;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+    VkAccessFlags srcAccessMask;
+    VkAccessFlags dstAccessMask;
+  };
+
+  struct BarrierBatch {
+    std::vector<BarrierTemplate> barriers;
+    VkPipelineStageFlags srcStageMask = 0;
+    VkPipelineStageFlags dstStageMask = 0;
+  };
+
+  struct CompiledPass {
+    uint32_t passIndex;
+    BarrierBatch barriers;
+    // Attachments in declaration order, with their store ops.
+    std::vector<ResourceId> attachments;
+    std::vector<VkAttachmentStoreOp> storeOps;
+    std::vector<VkFormat> colorFormats;
+    VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+    // Null with dynamic rendering.
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    std::map<std::vector<VkImageView>, VkFramebuffer> framebuffers;
+  };
+
+  struct TransientImage {
+    VkImage image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkImageUsageFlags usage = 0;
+    uint32_t firstUse = 0;
+    uint32_t lastUse = 0;
+    // Transient that previously occupied the same memory, if any.
+    int32_t aliasPredecessor = -1;
+  };
+
+  struct MemoryBlock {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memoryTypeBits = ~0u;
+    uint32_t lastUse = 0;
+    ResourceId lastOccupant = 0;
+  };
+
+  static bool isWrite(AccessType type);
+  static bool isAttachment(AccessType type);
+  static VkAttachmentLoadOp attachmentLoadOp(LoadOp loadOp);
+  static bool needsPreviousContents(const ResourceAccess &access);
+  static VkImageLayout layoutFor(AccessType type);
+  static VkPipelineStageFlags stagesFor(AccessType type);
+  static VkAccessFlags accessesFor(const ResourceAccess &access);
+  static VkImageUsageFlags usageFor(AccessType type);
+  static VkImageAspectFlags aspectFor(VkFormat format);
+
+  void addAccess(uint32_t passIndex, const ResourceAccess &access);
+  size_t topologyHash() const;
+  bool matchesCompiled() const;
+  void compile();
+  void cullPasses(std::vector<uint32_t> &livePasses) const;
+  void createTransientImages(const std::vector<uint32_t> &livePasses);
+  void computeBarriers(const std::vector<uint32_t> &livePasses);
+  void collectAttachments(CompiledPass &compiledPass, uint32_t livePosition);
+  void createRenderPass(CompiledPass &compiledPass);
+  void beginRendering(VkCommandBuffer commandBuffer,
+                      const CompiledPass &compiledPass, const PassDecl &pass,
+                      VkExtent2D extent);
+  VkAttachmentStoreOp storeOpFor(uint32_t livePosition,
+                                 ResourceId resource) const;
+  VkFramebuffer getFramebuffer(CompiledPass &compiledPass);
+  void recordBarriers(VkCommandBuffer commandBuffer,
+                      const BarrierBatch &batch) const;
+  void createTimestampQueryPool();
+  void readPassTimings();
+  void destroyCompiled();
+
+  Device &device;
+
+  std::vector<PassDecl> passes;
+  std::vector<ResourceDecl> resources;
+
+  bool compiled = false;
+  size_t compiledHash = 0;
+  // The declarations compiledPasses was built from, without callbacks, to
+  // confirm a hash match.
+  std::vector<ResourceDecl> compiledResourceDecls;
+  std::vector<PassDecl> compiledPassDecls;
+  std::vector<CompiledPass> compiledPasses;
+  std::vector<TransientImage> transientImages;
+  std::vector<MemoryBlock> memoryBlocks;
+  BarrierBatch finalBarriers;
+
+  VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+  bool timestampsPending = false;
+  std::vector<PassTiming> passTimings;
+
+  uint32_t culledPassCount = 0;
+  uint32_t aliasedImageCount = 0;
+  uint64_t rebuildCount = 0;
+};
+
+} // namespace engine
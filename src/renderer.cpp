@@ -1,7 +1,8 @@
 #include "renderer.hpp"
 #include "swapchain.hpp"
 
-#include <array>
+#include <algorithm>
+#include <chrono>
 #include <memory>
 #include <stdexcept>
 
@@ -10,39 +11,108 @@
 
 namespace engine {
 
+static void accumulateLatency(float &averageMs,
+                              std::chrono::steady_clock::duration sample) {
+  constexpr float SMOOTHING = 0.1f;
+  float sampleMs =
+      std::chrono::duration<float, std::milli>(sample).count();
+  averageMs = averageMs == 0.f
+                  ? sampleMs
+                  : averageMs + (sampleMs - averageMs) * SMOOTHING;
+}
+
 Renderer::Renderer(Window &window, Device &device,
-                   SwapChain::PresentMode presentMode)
-    : window(window), device(device), presentMode(presentMode) {
+                   SwapChain::PresentMode presentMode, uint32_t framesInFlight)
+    : window(&window), device(device), presentMode(presentMode),
+      framesInFlight(framesInFlight) {
+  if (framesInFlight < MIN_FRAMES_IN_FLIGHT ||
+      framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+    throw std::runtime_error("Unsupported number of frames in flight");
+  }
+
   recreateSwapChain();
+  init();
+}
+
+Renderer::Renderer(Device &device, VkExtent2D extent, uint32_t framesInFlight)
+    : device(device), framesInFlight(framesInFlight) {
+  if (framesInFlight < MIN_FRAMES_IN_FLIGHT ||
+      framesInFlight > MAX_FRAMES_IN_FLIGHT) {
+    throw std::runtime_error("Unsupported number of frames in flight");
+  }
+  if (!device.isHeadless()) {
+    throw std::runtime_error("Headless renderer requires a headless device");
+  }
+
+  offscreenTarget =
+      std::make_unique<OffscreenTarget>(device, extent, framesInFlight);
+  init();
+}
+
+void Renderer::init() {
   createCommandBuffers();
+  createSyncObjects();
+  createSecondaryCommandPools();
+  createRenderGraphs();
 }
 
-Renderer::~Renderer() { freeCommandBuffers(); }
+Renderer::~Renderer() {
+  destroySyncObjects();
+  destroySecondaryCommandPools();
+  freeCommandBuffers();
+}
 
 void Renderer::recreateSwapChain() {
-  auto extent = window.getExtent();
+  auto extent = window->getExtent();
   while (extent.width == 0 || extent.height == 0) {
-    extent = window.getExtent();
+    extent = window->getExtent();
     glfwWaitEvents();
   }
 
-  vkDeviceWaitIdle(device.device());
-
   if (swapChain == nullptr) {
     swapChain = std::make_unique<SwapChain>(device, extent, presentMode);
-  } else {
-    std::shared_ptr<SwapChain> oldSwapChain = std::move(swapChain);
-    swapChain = std::make_unique<SwapChain>(device, extent, oldSwapChain);
+    swapChainGeneration++;
+    return;
+  }
 
-    if (!oldSwapChain->compareSwapFormats(*swapChain.get())) {
-      throw std::runtime_error(
-          "Swap chain image (or depth) format has changed!");
-    }
+  // No device idle here: frames already in flight keep rendering to and
+  // presenting from the old swap chain, which is handed to the driver as
+  // oldSwapchain and destroyed once those frames have completed.
+  auto start = Clock::now();
+
+  // Present ids from the old swap chain can't be waited on any more.
+  pendingPresents.clear();
+
+  std::shared_ptr<SwapChain> oldSwapChain = std::move(swapChain);
+  swapChain =
+      std::make_unique<SwapChain>(device, extent, oldSwapChain, presentMode);
+  presentModeChanged = false;
+
+  if (!oldSwapChain->compareSwapFormats(*swapChain.get())) {
+    throw std::runtime_error(
+        "Swap chain image (or depth) format has changed!");
+  }
+
+  device.deferDestroy([retired = std::move(oldSwapChain)]() mutable {
+    retired.reset();
+  });
+  swapChainGeneration++;
+
+  swapChainStats.recreations++;
+  swapChainStats.lastRecreateMs =
+      std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+}
+
+void Renderer::setPresentMode(SwapChain::PresentMode mode) {
+  if (isHeadless() || mode == presentMode) {
+    return;
   }
+  presentMode = mode;
+  presentModeChanged = true;
 }
 
 void Renderer::createCommandBuffers() {
-  commandBuffers.resize(SwapChain::MAX_FRAMES_IN_FLIGHT);
+  commandBuffers.resize(framesInFlight);
 
   VkCommandBufferAllocateInfo allocInfo{};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -63,20 +133,184 @@ void Renderer::freeCommandBuffers() {
   commandBuffers.clear();
 }
 
+void Renderer::createRenderGraphs() {
+  renderGraphs.resize(framesInFlight);
+  for (auto &renderGraph : renderGraphs) {
+    renderGraph = std::make_unique<RenderGraph>(device);
+  }
+}
+
+void Renderer::createSyncObjects() {
+  imageAvailableSemaphores.resize(framesInFlight);
+  frameValues.assign(framesInFlight, 0);
+
+  VkSemaphoreCreateInfo semaphoreInfo{};
+  semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+  for (auto &semaphore : imageAvailableSemaphores) {
+    if (vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr,
+                          &semaphore) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to create image available semaphore");
+    }
+  }
+}
+
+void Renderer::destroySyncObjects() {
+  for (auto semaphore : imageAvailableSemaphores) {
+    vkDestroySemaphore(device.device(), semaphore, nullptr);
+  }
+  imageAvailableSemaphores.clear();
+}
+
+void Renderer::createSecondaryCommandPools() {
+  QueueFamilyIndices queueFamilyIndices = device.findPhysicalQueueFamilies();
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+  secondaryCommandPools.resize(framesInFlight);
+  for (auto &framePools : secondaryCommandPools) {
+    framePools.resize(recordingThreads.threadCount());
+    for (auto &pool : framePools) {
+      if (vkCreateCommandPool(device.device(), &poolInfo, nullptr,
+                              &pool.commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create secondary command pool");
+      }
+    }
+  }
+}
+
+void Renderer::destroySecondaryCommandPools() {
+  for (auto &framePools : secondaryCommandPools) {
+    for (auto &pool : framePools) {
+      vkDestroyCommandPool(device.device(), pool.commandPool, nullptr);
+    }
+  }
+  secondaryCommandPools.clear();
+}
+
+void Renderer::resetSecondaryCommandPools() {
+  for (auto &pool : secondaryCommandPools[currentFrameIndex]) {
+    if (pool.usedCount == 0) {
+      continue;
+    }
+    vkResetCommandPool(device.device(), pool.commandPool, 0);
+    pool.usedCount = 0;
+  }
+}
+
+VkCommandBuffer Renderer::beginSecondaryCommandBuffer(
+    SecondaryCommandPool &pool, const RenderGraph::PassContext &context) {
+  if (pool.usedCount == pool.commandBuffers.size()) {
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandPool = pool.commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device.device(), &allocInfo,
+                                 &commandBuffer) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to allocate secondary command buffer");
+    }
+    pool.commandBuffers.push_back(commandBuffer);
+  }
+
+  auto commandBuffer = pool.commandBuffers[pool.usedCount++];
+
+  VkCommandBufferInheritanceInfo inheritanceInfo{};
+  inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritanceInfo.renderPass = context.renderPass;
+  inheritanceInfo.subpass = 0;
+  inheritanceInfo.framebuffer = context.framebuffer;
+
+  VkCommandBufferInheritanceRenderingInfoKHR renderingInfo{};
+  if (context.renderPass == VK_NULL_HANDLE) {
+    renderingInfo.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+    renderingInfo.colorAttachmentCount = context.colorAttachmentCount;
+    renderingInfo.pColorAttachmentFormats = context.colorFormats;
+    renderingInfo.depthAttachmentFormat = context.depthFormat;
+    renderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    inheritanceInfo.pNext = &renderingInfo;
+  }
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                    VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    throw std::runtime_error(
+        "Failed to begin recording secondary command buffer");
+  }
+
+  VkViewport viewport{};
+  viewport.x = 0.f;
+  viewport.y = 0.f;
+  viewport.width = static_cast<float>(context.extent.width);
+  viewport.height = static_cast<float>(context.extent.height);
+  viewport.minDepth = 0.f;
+  viewport.maxDepth = 1.f;
+  VkRect2D scissor{{0, 0}, context.extent};
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+  return commandBuffer;
+}
+
 VkCommandBuffer Renderer::beginFrame() {
   assert(!isFrameStarted && "Can't call begin frame while already in progress");
 
-  auto result = swapChain->acquireNextImage(&currentImageIndex);
-  if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-    recreateSwapChain();
-    return nullptr;
-  }
+  // Everything owned by this frame slot, including its acquire semaphore,
+  // is free for reuse once the slot's previous submission has completed.
+  device.waitForFrame(frameValues[currentFrameIndex]);
+  device.collectGarbage();
+  collectPresentTimings();
 
-  if (result != VK_SUCCESS && VK_SUBOPTIMAL_KHR) {
-    throw std::runtime_error("Failed to acquire swap chain image");
+  if (isHeadless()) {
+    // The slot's previous submission has completed, so its image is free.
+    currentImageIndex = currentFrameIndex;
+  } else {
+    auto result = swapChain->acquireNextImage(
+        imageAvailableSemaphores[currentFrameIndex], &currentImageIndex);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      recreateSwapChain();
+      return nullptr;
+    }
+
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      throw std::runtime_error("Failed to acquire swap chain image");
+    }
   }
 
   isFrameStarted = true;
+  recordStartTime = Clock::now();
+  currentFrameValue = device.lastSubmittedFrame() + 1;
+  depthPrepassEnabled = depthPrepassRequested;
+  resetSecondaryCommandPools();
+
+  auto &renderGraph = *renderGraphs[currentFrameIndex];
+  renderGraph.reset();
+  if (isHeadless()) {
+    backbuffer = renderGraph.importImage(
+        "backbuffer", offscreenTarget->getImage(currentImageIndex),
+        offscreenTarget->getImageView(currentImageIndex),
+        {offscreenTarget->getImageFormat(), offscreenTarget->getExtent()},
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, swapChainGeneration);
+  } else {
+    backbuffer = renderGraph.importImage(
+        "backbuffer", swapChain->getImage(currentImageIndex),
+        swapChain->getImageView(currentImageIndex),
+        {swapChain->getSwapChainImageFormat(),
+         swapChain->getSwapChainExtent()},
+        VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, swapChainGeneration);
+  }
 
   auto commandBuffer = getCurrentCommandBuffer();
   VkCommandBufferBeginInfo beginInfo{};
@@ -93,66 +327,175 @@ void Renderer::endFrame() {
   assert(isFrameStarted && "Can't call endFrame while frame is not progress");
   auto commandBuffer = getCurrentCommandBuffer();
 
+  auto &renderGraph = *renderGraphs[currentFrameIndex];
+  renderGraph.execute(commandBuffer);
+  if (!renderGraph.getPassTimings().empty()) {
+    passTimings = renderGraph.getPassTimings();
+  }
+
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
     throw std::runtime_error("Failed to record command buffer");
   }
+  recordTimeMs = std::chrono::duration<float, std::milli>(Clock::now() -
+                                                          recordStartTime)
+                     .count();
 
-  auto result =
-      swapChain->submitCommandBuffers(&commandBuffer, &currentImageIndex);
+  submitCommandBuffer(commandBuffer);
+
+  if (isHeadless()) {
+    isFrameStarted = false;
+    currentFrameIndex = (currentFrameIndex + 1) % framesInFlight;
+    return;
+  }
+
+  uint64_t presentId = 0;
+  if (device.supportsPresentWait()) {
+    presentId = currentFrameValue;
+    pendingPresents.push_back({presentId, Clock::now()});
+  }
+  auto result = swapChain->present(currentImageIndex, presentId);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
-      window.wasWindowResized()) {
-    window.resetWindowResizedFlag();
+      window->wasWindowResized() || presentModeChanged) {
+    window->resetWindowResizedFlag();
     recreateSwapChain();
   } else if (result != VK_SUCCESS) {
     throw std::runtime_error("Failed to present swap chain image");
   }
 
   isFrameStarted = false;
-  currentFrameIndex = (currentFrameIndex + 1) % SwapChain::MAX_FRAMES_IN_FLIGHT;
+  currentFrameIndex = (currentFrameIndex + 1) % framesInFlight;
 }
 
-void Renderer::beginSwapChainRenderPass(VkCommandBuffer commandBuffer) {
-  assert(isFrameStarted &&
-         "Can't call beginSwapChainRenderPass if frame is not in progress");
-  assert(commandBuffer == getCurrentCommandBuffer() &&
-         "Can't begining render pass on command buffer from a different frame");
+void Renderer::submitCommandBuffer(VkCommandBuffer commandBuffer) {
+  VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrameIndex]};
+  VkPipelineStageFlags waitStages[] = {
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
+  uint64_t waitValues[] = {0};
+
+  // Headless frames have nothing to acquire or present, so they only
+  // signal the timeline, which is last in the list.
+  VkSemaphore signalSemaphores[] = {
+      isHeadless() ? VK_NULL_HANDLE
+                   : swapChain->getRenderFinishedSemaphore(currentImageIndex),
+      device.frameTimelineSemaphore()};
+  uint64_t signalValues[] = {0, currentFrameValue};
+  uint32_t waitCount = isHeadless() ? 0 : 1;
+  uint32_t firstSignal = isHeadless() ? 1 : 0;
+  uint32_t signalCount = 2 - firstSignal;
+
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = waitCount;
+  timelineInfo.pWaitSemaphoreValues = waitValues;
+  timelineInfo.signalSemaphoreValueCount = signalCount;
+  timelineInfo.pSignalSemaphoreValues = signalValues + firstSignal;
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = waitCount;
+  submitInfo.pWaitSemaphores = waitSemaphores;
+  submitInfo.pWaitDstStageMask = waitStages;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+  submitInfo.signalSemaphoreCount = signalCount;
+  submitInfo.pSignalSemaphores = signalSemaphores + firstSignal;
+
+  if (vkQueueSubmit(device.graphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("Failed to submit draw command buffer");
+  }
 
-  VkRenderPassBeginInfo renderPassInfo{};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = swapChain->getRenderPass();
-  renderPassInfo.framebuffer = swapChain->getFrameBuffer(currentImageIndex);
+  device.markFrameSubmitted(currentFrameValue);
+  frameValues[currentFrameIndex] = currentFrameValue;
 
-  renderPassInfo.renderArea.offset = {0, 0};
-  renderPassInfo.renderArea.extent = swapChain->getSwapChainExtent();
+  if (inputSampled) {
+    accumulateLatency(latencyStats.inputToSubmitMs,
+                      Clock::now() - inputSampleTime);
+    inputSampled = false;
+  }
+}
 
-  std::array<VkClearValue, 2> clearValues{};
-  clearValues[0].color = {0.01f, 0.01f, 0.01f, 1.0f};
-  clearValues[1].depthStencil = {1.0f, 0};
-  renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-  renderPassInfo.pClearValues = clearValues.data();
+void Renderer::waitForFrameSlot() {
+  assert(!isFrameStarted &&
+         "Can't call waitForFrameSlot while frame is in progress");
 
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo,
-                       VK_SUBPASS_CONTENTS_INLINE);
+  device.waitForFrame(frameValues[currentFrameIndex]);
 
-  VkViewport viewport{};
-  viewport.x = 0.f;
-  viewport.y = 0.f;
-  viewport.width = static_cast<float>(swapChain->getSwapChainExtent().width);
-  viewport.height = static_cast<float>(swapChain->getSwapChainExtent().height);
-  viewport.minDepth = 0.f;
-  viewport.maxDepth = 1.f;
-  VkRect2D scissor{{0, 0}, swapChain->getSwapChainExtent()};
-  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
-  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+  if (device.supportsPresentWait() && !pendingPresents.empty()) {
+    uint64_t queuedPresents = framesInFlight - 1;
+    uint64_t lastPresentId = pendingPresents.back().presentId;
+    if (lastPresentId > queuedPresents) {
+      // A timeout or out-of-date result just ends the wait early.
+      swapChain->waitForPresent(lastPresentId - queuedPresents,
+                                PRESENT_WAIT_TIMEOUT_NS);
+    }
+  }
+}
+
+void Renderer::markInputSampled() {
+  inputSampleTime = Clock::now();
+  inputSampled = true;
+}
+
+// Polls without blocking, so outside low-latency mode the measured time
+// can include up to a frame of polling delay.
+void Renderer::collectPresentTimings() {
+  while (!pendingPresents.empty()) {
+    const auto &pending = pendingPresents.front();
+    if (swapChain->waitForPresent(pending.presentId, 0) != VK_SUCCESS) {
+      break;
+    }
+    accumulateLatency(latencyStats.submitToPresentMs,
+                      Clock::now() - pending.submitTime);
+    pendingPresents.pop_front();
+  }
 }
 
-void Renderer::endSwapChainRenderPass(VkCommandBuffer commandBuffer) {
+void Renderer::executeSecondaryCommands(
+    VkCommandBuffer commandBuffer, const RenderGraph::PassContext &context,
+    size_t itemCount, const SecondaryRecordFn &record) {
   assert(isFrameStarted &&
-         "Can't call endSwapChainRenderPass if frame is not in progress");
+         "Can't call executeSecondaryCommands if frame is not in progress");
   assert(commandBuffer == getCurrentCommandBuffer() &&
-         "Can't end render pass on command buffer from a different frame");
+         "Can't execute secondary commands on command buffer from a different "
+         "frame");
+
+  auto &framePools = secondaryCommandPools[currentFrameIndex];
+
+  size_t rangeCount =
+      (itemCount + MIN_ITEMS_PER_SECONDARY - 1) / MIN_ITEMS_PER_SECONDARY;
+  rangeCount = std::clamp<size_t>(rangeCount, 1, framePools.size());
+  const size_t itemsPerRange = (itemCount + rangeCount - 1) / rangeCount;
+
+  std::vector<VkCommandBuffer> secondaryBuffers(rangeCount);
+
+  auto recordRange = [&](size_t rangeIndex) {
+    const size_t first = std::min(rangeIndex * itemsPerRange, itemCount);
+    const size_t last = std::min(first + itemsPerRange, itemCount);
 
-  vkCmdEndRenderPass(commandBuffer);
+    auto secondary =
+        beginSecondaryCommandBuffer(framePools[rangeIndex], context);
+    record(secondary, first, last);
+    if (vkEndCommandBuffer(secondary) != VK_SUCCESS) {
+      throw std::runtime_error("Failed to record secondary command buffer");
+    }
+    secondaryBuffers[rangeIndex] = secondary;
+  };
+
+  if (rangeCount == 1) {
+    recordRange(0);
+  } else {
+    for (size_t i = 0; i < rangeCount; i++) {
+      recordingThreads.submit([&recordRange, i] { recordRange(i); });
+    }
+    recordingThreads.wait();
+  }
+
+  vkCmdExecuteCommands(commandBuffer,
+                       static_cast<uint32_t>(secondaryBuffers.size()),
+                       secondaryBuffers.data());
 }
+
 } // namespace engine
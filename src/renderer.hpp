@@ -1,10 +1,17 @@
 #pragma once
 
 #include "device.hpp"
+#include "offscreen_target.hpp"
+#include "pipeline.hpp"
+#include "render_graph.hpp"
 #include "swapchain.hpp"
+#include "thread_pool.hpp"
 #include "window.hpp"
 
 #include <cassert>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <vector>
 
@@ -14,16 +21,74 @@ namespace engine {
 
 class Renderer {
 public:
-  Renderer(Window &window, Device &device, SwapChain::PresentMode presentMode);
+  // Exponential moving averages. submitToPresentMs stays zero when the
+  // device lacks present wait.
+  struct LatencyStats {
+    float inputToSubmitMs = 0.f;
+    float submitToPresentMs = 0.f;
+  };
+
+  struct SwapChainStats {
+    uint32_t recreations = 0;
+    float lastRecreateMs = 0.f;
+  };
+
+  static constexpr uint32_t MIN_FRAMES_IN_FLIGHT = 1;
+  static constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+  Renderer(Window &window, Device &device, SwapChain::PresentMode presentMode,
+           uint32_t framesInFlight);
+  // Headless: renders into a ring of offscreen images, one per frame in
+  // flight, that are never presented. Requires a headless device.
+  Renderer(Device &device, VkExtent2D extent, uint32_t framesInFlight);
   ~Renderer();
 
   Renderer(const Renderer &) = delete;
   Renderer &operator=(const Renderer &) = delete;
 
+  // When headless these describe the offscreen target instead.
   VkRenderPass getSwapChainRenderPass() const {
-    return swapChain->getRenderPass();
+    return swapChain ? swapChain->getRenderPass()
+                     : offscreenTarget->getRenderPass();
+  }
+  VkFormat getSwapChainImageFormat() const {
+    return swapChain ? swapChain->getSwapChainImageFormat()
+                     : offscreenTarget->getImageFormat();
+  }
+  VkFormat getSwapChainDepthFormat() const {
+    return swapChain ? swapChain->getSwapChainDepthFormat()
+                     : offscreenTarget->getDepthFormat();
+  }
+  VkExtent2D getSwapChainExtent() const {
+    return swapChain ? swapChain->getSwapChainExtent()
+                     : offscreenTarget->getExtent();
+  }
+  float getAspectRatio() const {
+    return swapChain ? swapChain->extentAspectRatio()
+                     : offscreenTarget->extentAspectRatio();
+  }
+  bool isHeadless() const { return offscreenTarget != nullptr; }
+  // For pipelines drawing into the backbuffer, or any image of the same
+  // formats. Stays valid across swap chain recreation.
+  RenderTargetLayout getRenderTargetLayout() const {
+    return {getSwapChainRenderPass(), getSwapChainImageFormat(),
+            getSwapChainDepthFormat()};
+  }
+
+  // The swap chain is rebuilt with the new mode at the end of the current
+  // (or next) frame. Ignored when headless.
+  void setPresentMode(SwapChain::PresentMode mode);
+  SwapChain::PresentMode getPresentMode() const {
+    return swapChain ? swapChain->getPresentMode() : SwapChain::IMMEDIATE;
+  }
+  bool isPresentModeSupported(SwapChain::PresentMode mode) const {
+    return swapChain && swapChain->isPresentModeSupported(mode);
+  }
+  // Transfer usage in particular depends on what the surface supports.
+  VkImageUsageFlags getBackbufferUsage() const {
+    return swapChain ? swapChain->getImageUsage()
+                     : offscreenTarget->getImageUsage();
   }
-  float getAspectRatio() const { return swapChain->extentAspectRatio(); }
   bool isFrameInProgress() const { return isFrameStarted; }
   VkCommandBuffer getCurrentCommandBuffer() const {
     assert(isFrameStarted &&
@@ -36,23 +101,147 @@ public:
            "Cannot get frame index when frame not in progress");
     return currentFrameIndex;
   }
+  uint32_t getFramesInFlight() const { return framesInFlight; }
+  // The value the device frame timeline reaches once this frame completes.
+  uint64_t getFrameValue() const {
+    assert(isFrameStarted &&
+           "Cannot get frame value when frame not in progress");
+    return currentFrameValue;
+  }
+
+  // Takes effect from the next beginFrame, so a frame never mixes modes.
+  void setDepthPrepassEnabled(bool enabled) { depthPrepassRequested = enabled; }
+  bool isDepthPrepassRequested() const { return depthPrepassRequested; }
+  bool isDepthPrepassEnabled() const {
+    assert(isFrameStarted &&
+           "Cannot query depth pre-pass when frame not in progress");
+    return depthPrepassEnabled;
+  }
+
+  // Passes added to the graph between beginFrame and endFrame are recorded
+  // by endFrame, after which the swap chain image is ready to present. When
+  // headless the backbuffer is left in whatever layout its last pass used.
+  RenderGraph &getRenderGraph() const {
+    assert(isFrameStarted &&
+           "Cannot get render graph when frame not in progress");
+    return *renderGraphs[currentFrameIndex];
+  }
+  RenderGraph::ResourceId getBackbuffer() const {
+    assert(isFrameStarted &&
+           "Cannot get backbuffer when frame not in progress");
+    return backbuffer;
+  }
+
+  // GPU time per pass of an earlier frame. Empty when timestamps are
+  // unsupported by the device.
+  const std::vector<RenderGraph::PassTiming> &getPassTimings() const {
+    return passTimings;
+  }
+
+  // For low-latency pacing, call before sampling input: blocks until the
+  // next frame slot is free and, with present wait, until no more than
+  // framesInFlight - 1 presents are queued, so beginFrame won't block
+  // after input has been read.
+  void waitForFrameSlot();
+  // Marks the point input was read; the next submit measures from here.
+  void markInputSampled();
+  const LatencyStats &getLatencyStats() const { return latencyStats; }
+  // CPU time the previous frame spent between acquire and submit, which
+  // excludes any time blocked on the swap chain.
+  float getRecordTimeMs() const { return recordTimeMs; }
+  const SwapChainStats &getSwapChainStats() const { return swapChainStats; }
+
+  using SecondaryRecordFn =
+      std::function<void(VkCommandBuffer commandBuffer, size_t first,
+                         size_t last)>;
 
   VkCommandBuffer beginFrame();
   void endFrame();
-  void beginSwapChainRenderPass(VkCommandBuffer commandBuffer);
-  void endSwapChainRenderPass(VkCommandBuffer commandBuffer);
+
+  // Splits [0, itemCount) into contiguous ranges and records each range into
+  // a secondary command buffer on a worker thread. The secondary buffers are
+  // executed into commandBuffer in range order, so the calling graph pass
+  // must use secondary command buffers.
+  void executeSecondaryCommands(VkCommandBuffer commandBuffer,
+                                const RenderGraph::PassContext &context,
+                                size_t itemCount,
+                                const SecondaryRecordFn &record);
 
 private:
+  // Below this many items per range the cost of handing work to another
+  // thread outweighs the recording itself.
+  static constexpr size_t MIN_ITEMS_PER_SECONDARY = 512;
+
+  struct SecondaryCommandPool {
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    std::vector<VkCommandBuffer> commandBuffers;
+    size_t usedCount = 0;
+  };
+
+  void init();
   void createCommandBuffers();
   void freeCommandBuffers();
+  void createSecondaryCommandPools();
+  void destroySecondaryCommandPools();
+  void resetSecondaryCommandPools();
+  VkCommandBuffer
+  beginSecondaryCommandBuffer(SecondaryCommandPool &pool,
+                              const RenderGraph::PassContext &context);
+  void createRenderGraphs();
+  void createSyncObjects();
+  void destroySyncObjects();
+  void submitCommandBuffer(VkCommandBuffer commandBuffer);
+  void collectPresentTimings();
   void recreateSwapChain();
 
-  Window &window;
+  Window *window = nullptr;
   Device &device;
-  SwapChain::PresentMode presentMode;
+  SwapChain::PresentMode presentMode = SwapChain::FIFO;
+  bool presentModeChanged = false;
+  uint32_t framesInFlight;
   std::unique_ptr<SwapChain> swapChain;
+  std::unique_ptr<OffscreenTarget> offscreenTarget;
   std::vector<VkCommandBuffer> commandBuffers;
 
+  std::vector<VkSemaphore> imageAvailableSemaphores;
+  // Timeline value of the last submission made from each frame slot.
+  std::vector<uint64_t> frameValues;
+  uint64_t currentFrameValue = 0;
+
+  // Bounds present waits, so a minimized or out-of-date swap chain can't
+  // stall the frame loop.
+  static constexpr uint64_t PRESENT_WAIT_TIMEOUT_NS = 100'000'000;
+
+  using Clock = std::chrono::steady_clock;
+  struct PendingPresent {
+    uint64_t presentId;
+    Clock::time_point submitTime;
+  };
+  // Presents not yet known to be displayed, oldest first.
+  std::deque<PendingPresent> pendingPresents;
+  Clock::time_point inputSampleTime;
+  Clock::time_point recordStartTime;
+  float recordTimeMs = 0.f;
+  bool inputSampled = false;
+  LatencyStats latencyStats{};
+  SwapChainStats swapChainStats{};
+
+  ThreadPool recordingThreads{ThreadPool::defaultThreadCount()};
+  // Indexed by [frame in flight][recording thread].
+  std::vector<std::vector<SecondaryCommandPool>> secondaryCommandPools;
+
+  // One graph per frame in flight, so a graph's compiled state is never
+  // rebuilt while a previous submission still uses it.
+  std::vector<std::unique_ptr<RenderGraph>> renderGraphs;
+  RenderGraph::ResourceId backbuffer = 0;
+  // Bumped on every swap chain recreation; imported as the backbuffer's
+  // version so the graphs rebuild their framebuffers.
+  uint64_t swapChainGeneration = 0;
+  std::vector<RenderGraph::PassTiming> passTimings;
+
+  bool depthPrepassRequested{false};
+  bool depthPrepassEnabled{false};
+
   uint32_t currentImageIndex;
   int currentFrameIndex{0};
   bool isFrameStarted{false};
@@ -0,0 +1,58 @@
+#include "resolution_scaler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace engine {
+
+ResolutionScaler::ResolutionScaler(const Settings &settings)
+    : settings{settings}, scale{settings.maxScale} {
+  if (settings.minScale <= 0.f || settings.minScale > settings.maxScale ||
+      settings.maxScale > 1.f) {
+    throw std::runtime_error("Resolution scale bounds must satisfy "
+                             "0 < min <= max <= 1");
+  }
+  if (settings.targetGpuMs <= 0.f || settings.adjustInterval == 0) {
+    throw std::runtime_error("Invalid resolution scaler settings");
+  }
+}
+
+bool ResolutionScaler::update(float gpuMs) {
+  gpuMsSum += gpuMs;
+  sampleCount++;
+  if (sampleCount < settings.adjustInterval) {
+    return false;
+  }
+
+  float averageMs = gpuMsSum / sampleCount;
+  gpuMsSum = 0.f;
+  sampleCount = 0;
+  if (averageMs <= 0.f) {
+    return false;
+  }
+
+  if (averageMs < settings.targetGpuMs &&
+      averageMs > settings.targetGpuMs * UPSCALE_HEADROOM) {
+    return false;
+  }
+
+  float desired = scale * std::sqrt(settings.targetGpuMs / averageMs);
+  // Move halfway, since the estimate ignores fixed per-frame costs.
+  float next = scale + (desired - scale) * 0.5f;
+  next = std::round(next / SCALE_STEP) * SCALE_STEP;
+  next = std::clamp(next, settings.minScale, settings.maxScale);
+
+  if (std::abs(next - scale) < SCALE_STEP * 0.5f) {
+    return false;
+  }
+  scale = next;
+  return true;
+}
+
+VkExtent2D ResolutionScaler::scaleExtent(VkExtent2D extent) const {
+  return {std::max(1u, static_cast<uint32_t>(extent.width * scale)),
+          std::max(1u, static_cast<uint32_t>(extent.height * scale))};
+}
+
+} // namespace engine
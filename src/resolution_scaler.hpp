@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include <vulkan/vulkan_core.h>
+
+namespace engine {
+
+// Picks the internal render resolution from measured GPU frame time. GPU
+// cost is treated as proportional to pixel count, so the scale (applied to
+// both axes) moves by the square root of the ratio between target and
+// measured time.
+class ResolutionScaler {
+public:
+  struct Settings {
+    float minScale = 0.5f;
+    float maxScale = 1.f;
+    float targetGpuMs = 12.f;
+    // Frames averaged per adjustment. Every change rebuilds the render
+    // graph's transient images, so this also bounds that cost.
+    uint32_t adjustInterval = 16;
+  };
+
+  explicit ResolutionScaler(const Settings &settings);
+
+  ResolutionScaler(const ResolutionScaler &) = delete;
+  ResolutionScaler &operator=(const ResolutionScaler &) = delete;
+
+  // Feeds one frame's GPU time. Returns true when the scale changed.
+  bool update(float gpuMs);
+
+  float getScale() const { return scale; }
+  // Never smaller than 1x1.
+  VkExtent2D scaleExtent(VkExtent2D extent) const;
+
+private:
+  // Scales are quantized to this step so that noise doesn't cause a
+  // rebuild on every adjustment.
+  static constexpr float SCALE_STEP = 0.05f;
+  // Only scale up once comfortably under budget, so the controller doesn't
+  // oscillate around the target.
+  static constexpr float UPSCALE_HEADROOM = 0.85f;
+
+  Settings settings;
+  float scale;
+  float gpuMsSum = 0.f;
+  uint32_t sampleCount = 0;
+};
+
+} // namespace engine
@@ -0,0 +1,385 @@
+#include "scene.hpp"
+#include "model.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <stdexcept>
+
+namespace engine {
+
+namespace {
+
+// Calls fn(begin, end) over [0, count), in chunks of at least minChunk on
+// threadPool if there is one and enough work, otherwise inline.
+template <typename Fn>
+void parallelFor(ThreadPool *threadPool, uint32_t count, uint32_t minChunk,
+                 const Fn &fn) {
+  uint32_t chunks = threadPool ? std::min(threadPool->threadCount(),
+                                          count / minChunk)
+                               : 1;
+  if (chunks <= 1) {
+    fn(0u, count);
+    return;
+  }
+
+  uint32_t chunkSize = (count + chunks - 1) / chunks;
+  for (uint32_t begin = 0; begin < count; begin += chunkSize) {
+    uint32_t end = std::min(begin + chunkSize, count);
+    threadPool->submit([&fn, begin, end] { fn(begin, end); });
+  }
+  threadPool->wait();
+}
+
+} // namespace
+
+Scene::ModelId Scene::addModel(std::shared_ptr<Model> model) {
+  Aabb bounds = model->getBounds();
+  return addModel(std::move(model), bounds);
+}
+
+Scene::ModelId Scene::addModel(std::shared_ptr<Model> model,
+                               const Aabb &bounds) {
+  models.push_back(std::move(model));
+  modelBounds.push_back(bounds);
+  return static_cast<ModelId>(models.size() - 1);
+}
+
+Entity Scene::createEntity(ModelId model, const TransformComponent &transform,
+                           const glm::vec3 &color) {
+  assert(model < models.size() && "Unknown model");
+
+  uint32_t slot;
+  if (!freeSlots.empty()) {
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+  } else {
+    slot = static_cast<uint32_t>(slots.size());
+    slots.emplace_back();
+  }
+
+  slots[slot].denseIndex = size();
+  slots[slot].alive = true;
+  denseToSlot.push_back(slot);
+
+  translations_.push_back(transform.translation);
+  rotations_.push_back(transform.rotation);
+  scales_.push_back(transform.scale);
+  colors_.push_back(color);
+  modelIds_.push_back(model);
+  flags_.push_back(VISIBLE);
+  parents.emplace_back();
+  localMatrices.emplace_back();
+  matrices_.emplace_back();
+  matrixVersions_.push_back(0);
+  worldBounds_.emplace_back();
+  // Inserted into the Bvh once its bounds are known.
+  proxies.push_back(Bvh::NULL_PROXY);
+  markTransformDirty(size() - 1);
+  hierarchyChanged = true;
+
+  return {slot, slots[slot].generation};
+}
+
+void Scene::destroyEntity(Entity entity) {
+  assert(isAlive(entity) && "Entity was already destroyed");
+
+  uint32_t index = slots[entity.slot].denseIndex;
+  uint32_t last = size() - 1;
+
+  if (proxies[index] != Bvh::NULL_PROXY) {
+    bvh.remove(proxies[index]);
+  }
+  proxies[index] = proxies[last];
+  if (proxies[index] != Bvh::NULL_PROXY) {
+    bvh.setUserData(proxies[index], index);
+  }
+  worldBounds_[index] = worldBounds_[last];
+
+  // Move the last entity into the hole so the arrays stay dense.
+  translations_[index] = translations_[last];
+  rotations_[index] = rotations_[last];
+  scales_[index] = scales_[last];
+  colors_[index] = colors_[last];
+  modelIds_[index] = modelIds_[last];
+  // The moved entity's matrices are at a new index now, so whatever copied
+  // them by index has to copy them again.
+  flags_[index] = flags_[last];
+  markTransformDirty(index);
+  parents[index] = parents[last];
+  denseToSlot[index] = denseToSlot[last];
+  slots[denseToSlot[index]].denseIndex = index;
+
+  translations_.pop_back();
+  rotations_.pop_back();
+  scales_.pop_back();
+  colors_.pop_back();
+  modelIds_.pop_back();
+  flags_.pop_back();
+  parents.pop_back();
+  localMatrices.pop_back();
+  matrices_.pop_back();
+  matrixVersions_.pop_back();
+  worldBounds_.pop_back();
+  proxies.pop_back();
+  denseToSlot.pop_back();
+  hierarchyChanged = true;
+
+  slots[entity.slot].alive = false;
+  slots[entity.slot].generation++;
+  freeSlots.push_back(entity.slot);
+}
+
+bool Scene::isAlive(Entity entity) const {
+  return entity.slot < slots.size() && slots[entity.slot].alive &&
+         slots[entity.slot].generation == entity.generation;
+}
+
+void Scene::reserve(uint32_t count) {
+  translations_.reserve(count);
+  rotations_.reserve(count);
+  scales_.reserve(count);
+  colors_.reserve(count);
+  modelIds_.reserve(count);
+  flags_.reserve(count);
+  parents.reserve(count);
+  localMatrices.reserve(count);
+  matrices_.reserve(count);
+  matrixVersions_.reserve(count);
+  worldBounds_.reserve(count);
+  proxies.reserve(count);
+  denseToSlot.reserve(count);
+  slots.reserve(count);
+}
+
+uint32_t Scene::indexOf(Entity entity) const {
+  assert(isAlive(entity) && "Entity was destroyed");
+  return slots[entity.slot].denseIndex;
+}
+
+Entity Scene::entityAt(uint32_t index) const {
+  uint32_t slot = denseToSlot[index];
+  return {slot, slots[slot].generation};
+}
+
+TransformComponent Scene::getTransform(uint32_t index) const {
+  TransformComponent transform{};
+  transform.translation = translations_[index];
+  transform.rotation = rotations_[index];
+  transform.scale = scales_[index];
+  return transform;
+}
+
+void Scene::setTransform(uint32_t index, const TransformComponent &transform) {
+  if (translations_[index] == transform.translation &&
+      rotations_[index] == transform.rotation &&
+      scales_[index] == transform.scale) {
+    return;
+  }
+
+  markTransformDirty(index);
+  translations_[index] = transform.translation;
+  rotations_[index] = transform.rotation;
+  scales_[index] = transform.scale;
+}
+
+void Scene::setParent(Entity child, Entity parent) {
+  assert(isAlive(child) && "Entity was destroyed");
+  assert((parent == Entity{} || isAlive(parent)) && "Parent was destroyed");
+
+  // Ancestors destroyed since the last sortHierarchy() end the chain.
+  for (Entity ancestor = parent; ancestor != Entity{} && isAlive(ancestor);
+       ancestor = parents[indexOf(ancestor)]) {
+    if (ancestor == child) {
+      throw std::runtime_error(
+          "Failed to set parent: the entity is an ancestor of the parent");
+    }
+  }
+
+  uint32_t index = indexOf(child);
+  parents[index] = parent;
+  markTransformDirty(index);
+  hierarchyChanged = true;
+}
+
+Entity Scene::getParent(Entity child) const {
+  return parents[indexOf(child)];
+}
+
+void Scene::updateHierarchy() {
+  if (hierarchyChanged) {
+    sortHierarchy();
+  }
+}
+
+uint32_t Scene::updateMatrices(ThreadPool *threadPool) {
+  updateHierarchy();
+
+  const uint32_t count = size();
+  const uint64_t version = matrixVersion + 1;
+
+  // Local matrices, recomputing runs of dirty entities together so they go
+  // through the batched kernel. Flags are cleared below.
+  parallelFor(threadPool, count, MIN_ENTITIES_PER_TASK,
+              [&](uint32_t begin, uint32_t end) {
+                uint32_t i = begin;
+                while (i < end) {
+                  if (!(flags_[i] & TRANSFORM_DIRTY)) {
+                    i++;
+                    continue;
+                  }
+                  uint32_t first = i;
+                  while (i < end && (flags_[i] & TRANSFORM_DIRTY)) {
+                    i++;
+                  }
+                  computeObjectMatrices(
+                      translations_.data() + first, rotations_.data() + first,
+                      scales_.data() + first, i - first,
+                      localMatrices.data() + first);
+                }
+              });
+
+  // World matrices, a level at a time so every parent is final before its
+  // children read it. An entity is recomputed if it is dirty or its parent
+  // was recomputed in this call, so clean subtrees are skipped.
+  std::atomic<uint32_t> recomputed{0};
+  for (size_t level = 0; level + 1 < levelOffsets_.size(); level++) {
+    const uint32_t *entities = depthOrder_.data() + levelOffsets_[level];
+    uint32_t levelSize = levelOffsets_[level + 1] - levelOffsets_[level];
+
+    parallelFor(threadPool, levelSize, MIN_ENTITIES_PER_TASK,
+                [&](uint32_t begin, uint32_t end) {
+                  uint32_t updated = 0;
+                  for (uint32_t k = begin; k < end; k++) {
+                    uint32_t i = entities[k];
+                    uint32_t parent = parentIndices_[i];
+                    bool parentChanged = parent != NO_PARENT &&
+                                         matrixVersions_[parent] == version;
+                    if (!(flags_[i] & TRANSFORM_DIRTY) && !parentChanged) {
+                      continue;
+                    }
+
+                    flags_[i] &= ~TRANSFORM_DIRTY;
+                    if (parent == NO_PARENT) {
+                      matrices_[i] = localMatrices[i];
+                    } else {
+                      matrices_[i].modelMatrix =
+                          matrices_[parent].modelMatrix *
+                          localMatrices[i].modelMatrix;
+                      matrices_[i].normalMatrix =
+                          matrices_[parent].normalMatrix *
+                          localMatrices[i].normalMatrix;
+                    }
+                    worldBounds_[i] = modelBounds[modelIds_[i]].transformed(
+                        matrices_[i].modelMatrix);
+                    matrixVersions_[i] = version;
+                    updated++;
+                  }
+                  recomputed += updated;
+                });
+  }
+
+  dirtyIndices.clear();
+  if (recomputed > 0) {
+    matrixVersion = version;
+    updateBvh();
+  }
+  return recomputed;
+}
+
+void Scene::collectDirtyTransforms(std::vector<uint32_t> &indices) {
+  indices.clear();
+  for (uint32_t i : dirtyIndices) {
+    // Skips entries destroyed since and repeats, whose flag is already
+    // cleared.
+    if (i < size() && (flags_[i] & TRANSFORM_DIRTY)) {
+      flags_[i] &= ~TRANSFORM_DIRTY;
+      indices.push_back(i);
+    }
+  }
+  dirtyIndices.clear();
+}
+
+// Tree updates don't parallelize, so this runs after propagation. Entities
+// whose bounds only moved within their fattened box leave the tree alone.
+void Scene::updateBvh() {
+  const uint32_t count = size();
+  uint32_t inserted = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (matrixVersions_[i] != matrixVersion) {
+      continue;
+    }
+    if (proxies[i] == Bvh::NULL_PROXY) {
+      proxies[i] = bvh.insert(worldBounds_[i], i);
+      inserted++;
+    } else {
+      bvh.update(proxies[i], worldBounds_[i]);
+    }
+  }
+
+  // Incremental inserts build a worse tree than a rebuild, which matters
+  // when most of the scene was just loaded.
+  if (inserted > bvh.getLeafCount() / 2) {
+    bvh.rebuild();
+  }
+}
+
+// Resolves parent handles to dense indices and counting-sorts entities by
+// depth. Children of destroyed entities become roots here.
+void Scene::sortHierarchy() {
+  constexpr uint32_t UNKNOWN_DEPTH = ~0u;
+  const uint32_t count = size();
+
+  parentIndices_.assign(count, NO_PARENT);
+  for (uint32_t i = 0; i < count; i++) {
+    if (parents[i] == Entity{}) {
+      continue;
+    }
+    if (isAlive(parents[i])) {
+      parentIndices_[i] = indexOf(parents[i]);
+    } else {
+      parents[i] = Entity{};
+      markTransformDirty(i);
+    }
+  }
+
+  // Walks up to the first ancestor with a known depth, then fills in the
+  // depths on the way back down, so each entity is visited about once.
+  std::vector<uint32_t> depths(count, UNKNOWN_DEPTH);
+  std::vector<uint32_t> path;
+  uint32_t levels = count > 0 ? 1 : 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t j = i;
+    while (depths[j] == UNKNOWN_DEPTH && parentIndices_[j] != NO_PARENT) {
+      path.push_back(j);
+      j = parentIndices_[j];
+    }
+    if (depths[j] == UNKNOWN_DEPTH) {
+      depths[j] = 0;
+    }
+    for (; !path.empty(); path.pop_back()) {
+      uint32_t k = path.back();
+      depths[k] = depths[parentIndices_[k]] + 1;
+      levels = std::max(levels, depths[k] + 1);
+    }
+  }
+
+  levelOffsets_.assign(levels + 1, 0);
+  for (uint32_t i = 0; i < count; i++) {
+    levelOffsets_[depths[i] + 1]++;
+  }
+  for (uint32_t level = 0; level < levels; level++) {
+    levelOffsets_[level + 1] += levelOffsets_[level];
+  }
+
+  depthOrder_.resize(count);
+  std::vector<uint32_t> next(levelOffsets_.begin(), levelOffsets_.end() - 1);
+  for (uint32_t i = 0; i < count; i++) {
+    depthOrder_[next[depths[i]]++] = i;
+  }
+
+  hierarchyChanged = false;
+  hierarchyVersion++;
+}
+
+} // namespace engine
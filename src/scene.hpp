@@ -0,0 +1,191 @@
+#pragma once
+
+#include "bvh.hpp"
+#include "gameobject.hpp"
+#include "thread_pool.hpp"
+#include "transform_batch.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace engine {
+
+class Model;
+
+// Refers to an entity in a Scene for as long as it lives. Handles of
+// destroyed entities never match a later entity, even one reusing the slot.
+struct Entity {
+  static constexpr uint32_t INVALID_SLOT = ~0u;
+
+  uint32_t slot = INVALID_SLOT;
+  uint32_t generation = 0;
+
+  bool operator==(const Entity &other) const {
+    return slot == other.slot && generation == other.generation;
+  }
+  bool operator!=(const Entity &other) const { return !(*this == other); }
+};
+
+// Entity components as dense arrays (structure of arrays). Entry i of every
+// array belongs to the same entity and live entities fill [0, size()), so a
+// system walks only the arrays it needs, front to back. Destroying an entity
+// moves the last one into its place: dense indices change, Entity handles
+// don't.
+//
+// Models are stored once in the scene and referenced by ModelId, so entities
+// hold no reference counts.
+//
+// World bounds of every entity are kept in a Bvh for culling, picking and
+// proximity queries; its user data is the entity's dense index.
+//
+// Entities can have a parent, in which case their transform is relative to
+// it. Model and normal matrices are cached per entity and only recomputed by
+// updateMatrices() for entities whose transform or whose ancestors' changed.
+// setTransform() marks an entity dirty; code writing the component arrays
+// directly must call markTransformDirty() itself.
+class Scene {
+public:
+  using ModelId = uint32_t;
+
+  static constexpr uint32_t NO_PARENT = ~0u;
+
+  enum Flags : uint32_t {
+    VISIBLE = 1u << 0,
+    // Set when the cached matrices are stale.
+    TRANSFORM_DIRTY = 1u << 1,
+  };
+
+  Scene() = default;
+
+  Scene(const Scene &) = delete;
+  Scene &operator=(const Scene &) = delete;
+
+  ModelId addModel(std::shared_ptr<Model> model);
+  // With bounds other than the model's own, or for a null model.
+  ModelId addModel(std::shared_ptr<Model> model, const Aabb &bounds);
+  Model &getModel(ModelId id) const { return *models[id]; }
+
+  Entity createEntity(ModelId model, const TransformComponent &transform,
+                      const glm::vec3 &color = glm::vec3{1.f});
+  void destroyEntity(Entity entity);
+  bool isAlive(Entity entity) const;
+  void reserve(uint32_t count);
+
+  uint32_t size() const { return static_cast<uint32_t>(denseToSlot.size()); }
+  bool empty() const { return denseToSlot.empty(); }
+  // Dense index of a live entity.
+  uint32_t indexOf(Entity entity) const;
+  Entity entityAt(uint32_t index) const;
+
+  // Component arrays, size() entries each.
+  glm::vec3 *translations() { return translations_.data(); }
+  const glm::vec3 *translations() const { return translations_.data(); }
+  glm::vec3 *rotations() { return rotations_.data(); }
+  const glm::vec3 *rotations() const { return rotations_.data(); }
+  glm::vec3 *scales() { return scales_.data(); }
+  const glm::vec3 *scales() const { return scales_.data(); }
+  glm::vec3 *colors() { return colors_.data(); }
+  const glm::vec3 *colors() const { return colors_.data(); }
+  ModelId *modelIds() { return modelIds_.data(); }
+  const ModelId *modelIds() const { return modelIds_.data(); }
+  uint32_t *flags() { return flags_.data(); }
+  const uint32_t *flags() const { return flags_.data(); }
+
+  // An empty Entity{} makes child a root again. Throws if parent is child
+  // or one of its descendants. When a parent is destroyed its children
+  // become roots, keeping their local transforms.
+  void setParent(Entity child, Entity parent);
+  Entity getParent(Entity child) const;
+
+  // Brings the arrays below up to date after entities were added, removed
+  // or reparented. updateMatrices() does so itself; code computing matrices
+  // elsewhere, e.g. GpuTransforms, calls this instead.
+  void updateHierarchy();
+  // Dense indices ordered by depth in the hierarchy, roots first; level d
+  // is [levelOffsets()[d], levelOffsets()[d + 1]).
+  const uint32_t *depthOrder() const { return depthOrder_.data(); }
+  const std::vector<uint32_t> &levelOffsets() const { return levelOffsets_; }
+  // Dense index of each entity's parent, or NO_PARENT.
+  const uint32_t *parentIndices() const { return parentIndices_.data(); }
+  // Increases whenever the arrays above change.
+  uint64_t getHierarchyVersion() const { return hierarchyVersion; }
+
+  TransformComponent getTransform(uint32_t index) const;
+  // Marks the entity dirty only if the transform differs.
+  void setTransform(uint32_t index, const TransformComponent &transform);
+  void markTransformDirty(uint32_t index) {
+    flags_[index] |= TRANSFORM_DIRTY;
+    dirtyIndices.push_back(index);
+  }
+  // Replaces indices with the dense indices of dirty entities and clears
+  // their dirty flags, for code computing matrices elsewhere instead of
+  // calling updateMatrices(), e.g. GpuTransforms. Costs O(dirty entities).
+  void collectDirtyTransforms(std::vector<uint32_t> &indices);
+
+  // Recomputes the cached world matrices of dirty entities and their
+  // descendants and returns how many were recomputed. Entities recomputed
+  // by one call share a version number, higher than any before.
+  //
+  // Runs one hierarchy level at a time, parents before children; levels
+  // large enough are split across threadPool when one is given.
+  uint32_t updateMatrices(ThreadPool *threadPool = nullptr);
+  const ObjectMatrices *matrices() const { return matrices_.data(); }
+  // The model's bounds under each entity's world matrix.
+  const Aabb *worldBounds() const { return worldBounds_.data(); }
+  // Brought up to date with worldBounds() by updateMatrices().
+  const Bvh &getBvh() const { return bvh; }
+  Bvh &getBvh() { return bvh; }
+  // Version of each entity's matrices; compare with getMatrixVersion() from
+  // an earlier frame to find what changed since.
+  const uint64_t *matrixVersions() const { return matrixVersions_.data(); }
+  uint64_t getMatrixVersion() const { return matrixVersion; }
+
+private:
+  struct Slot {
+    uint32_t denseIndex = 0;
+    uint32_t generation = 0;
+    bool alive = false;
+  };
+
+  // Smallest share of a level worth handing to another thread.
+  static constexpr uint32_t MIN_ENTITIES_PER_TASK = 4096;
+
+  void sortHierarchy();
+  void updateBvh();
+
+  std::vector<std::shared_ptr<Model>> models;
+  std::vector<Aabb> modelBounds;
+
+  std::vector<glm::vec3> translations_;
+  std::vector<glm::vec3> rotations_;
+  std::vector<glm::vec3> scales_;
+  std::vector<glm::vec3> colors_;
+  std::vector<ModelId> modelIds_;
+  std::vector<uint32_t> flags_;
+  std::vector<Entity> parents;
+  std::vector<ObjectMatrices> localMatrices;
+  std::vector<ObjectMatrices> matrices_;
+  std::vector<uint64_t> matrixVersions_;
+  uint64_t matrixVersion = 0;
+  // Every index marked dirty since the last update, possibly more than once
+  // or past the end after destroyEntity(); only the flags are exact.
+  std::vector<uint32_t> dirtyIndices;
+  std::vector<Aabb> worldBounds_;
+  std::vector<Bvh::ProxyId> proxies;
+  Bvh bvh;
+
+  std::vector<uint32_t> depthOrder_;
+  std::vector<uint32_t> levelOffsets_;
+  std::vector<uint32_t> parentIndices_;
+  bool hierarchyChanged = true;
+  uint64_t hierarchyVersion = 0;
+
+  std::vector<uint32_t> denseToSlot;
+  std::vector<Slot> slots;
+  std::vector<uint32_t> freeSlots;
+};
+
+} // namespace engine
@@ -0,0 +1,194 @@
+#include "scene_benchmark.hpp"
+#include "benchmark.hpp"
+#include "gameobject.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace engine {
+
+namespace {
+
+constexpr float DT = 1.f / 60.f;
+// Each measurement runs over about this many entities in total, best of
+// RUNS, so small counts aren't dominated by timer resolution.
+constexpr uint64_t ENTITIES_PER_RUN = 10'000'000;
+constexpr int RUNS = 5;
+
+// Stands in for a model, which would need a device.
+const Aabb UNIT_BOUNDS{glm::vec3{-0.5f}, glm::vec3{0.5f}};
+
+TransformComponent initialTransform(uint32_t i) {
+  TransformComponent transform{};
+  transform.translation = {static_cast<float>(i % 1000), 0.f,
+                           static_cast<float>(i / 1000)};
+  transform.rotation = {0.f, static_cast<float>(i) * 0.01f, 0.f};
+  return transform;
+}
+
+// Nanoseconds per entity.
+template <typename Fn> double measure(uint32_t count, Fn &&fn) {
+  uint64_t repeats = std::max<uint64_t>(1, ENTITIES_PER_RUN / count);
+  return benchmark::bestOf(RUNS, repeats, fn) * 1e9 / count;
+}
+
+void benchmarkCount(uint32_t count) {
+  const glm::vec3 velocity{0.f, 0.f, 0.5f};
+  const float spin = 0.25f;
+
+  std::vector<GameObject> gameObjects;
+  gameObjects.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    auto gameObject = GameObject::create();
+    gameObject.transform = initialTransform(i);
+    gameObjects.push_back(std::move(gameObject));
+  }
+
+  Scene scene;
+  scene.reserve(count);
+  auto model = scene.addModel(nullptr, UNIT_BOUNDS);
+  for (uint32_t i = 0; i < count; i++) {
+    scene.createEntity(model, initialTransform(i));
+  }
+
+  // Iteration reads positions only, like a culling or bounds pass.
+  double aosIterate = measure(count, [&] {
+    glm::vec3 sum{0.f};
+    for (const auto &gameObject : gameObjects) {
+      sum += gameObject.transform.translation;
+    }
+    benchmark::keep(sum.x + sum.y + sum.z);
+  });
+  double soaIterate = measure(count, [&] {
+    glm::vec3 sum{0.f};
+    const glm::vec3 *translations = scene.translations();
+    for (uint32_t i = 0; i < scene.size(); i++) {
+      sum += translations[i];
+    }
+    benchmark::keep(sum.x + sum.y + sum.z);
+  });
+
+  double aosUpdate = measure(count, [&] {
+    for (auto &gameObject : gameObjects) {
+      gameObject.transform.translation += velocity * DT;
+      gameObject.transform.rotation.y += spin * DT;
+    }
+    benchmark::keep(gameObjects.back().transform.rotation.y);
+  });
+  double soaUpdate = measure(count, [&] {
+    glm::vec3 *translations = scene.translations();
+    glm::vec3 *rotations = scene.rotations();
+    for (uint32_t i = 0; i < scene.size(); i++) {
+      translations[i] += velocity * DT;
+      rotations[i].y += spin * DT;
+    }
+    benchmark::keep(rotations[scene.size() - 1].y);
+  });
+
+  std::cout << std::fixed << std::setprecision(2) << std::setw(8) << count
+            << " entities | iterate " << aosIterate << " -> " << soaIterate
+            << " ns | update " << aosUpdate << " -> " << soaUpdate << " ns"
+            << std::endl;
+}
+
+// roots, each with a tree of the given depth where every entity has
+// branching children.
+void buildHierarchy(Scene &scene, uint32_t roots, uint32_t depth,
+                    uint32_t branching) {
+  auto model = scene.addModel(nullptr, UNIT_BOUNDS);
+  TransformComponent local{};
+  local.translation = {0.f, 1.f, 0.f};
+  local.rotation = {0.f, 0.1f, 0.f};
+
+  std::vector<Entity> level;
+  for (uint32_t i = 0; i < roots; i++) {
+    level.push_back(scene.createEntity(model, initialTransform(i)));
+  }
+  for (uint32_t d = 1; d < depth; d++) {
+    std::vector<Entity> children;
+    for (Entity parent : level) {
+      for (uint32_t b = 0; b < branching; b++) {
+        Entity child = scene.createEntity(model, local);
+        scene.setParent(child, parent);
+        children.push_back(child);
+      }
+    }
+    level = std::move(children);
+  }
+  scene.updateMatrices();
+}
+
+void benchmarkHierarchy(const char *name, uint32_t roots, uint32_t depth,
+                        uint32_t branching, ThreadPool &threadPool) {
+  Scene scene;
+  buildHierarchy(scene, roots, depth, branching);
+  const uint32_t count = scene.size();
+
+  // Milliseconds per update, single threaded and on threadPool.
+  auto measureUpdate = [&](auto &&change) {
+    double ms[2];
+    for (int threaded = 0; threaded < 2; threaded++) {
+      ThreadPool *pool = threaded ? &threadPool : nullptr;
+      ms[threaded] = measure(count, [&] {
+                       change();
+                       benchmark::keep(scene.updateMatrices(pool));
+                     }) *
+                     count / 1e6;
+    }
+    return std::make_pair(ms[0], ms[1]);
+  };
+
+  auto all = measureUpdate([&] {
+    for (uint32_t i = 0; i < count; i++) {
+      scene.markTransformDirty(i);
+    }
+  });
+  // The first root and its subtree, 1 / roots of the scene. Roots sort
+  // first, so it is at dense index 0.
+  const uint32_t root = 0;
+  float offset = 0.f;
+  auto subtree = measureUpdate([&] {
+    auto transform = scene.getTransform(root);
+    transform.translation.x = offset += 1.f;
+    scene.setTransform(root, transform);
+  });
+  auto clean = measureUpdate([] {});
+
+  std::cout << std::fixed << std::setprecision(3) << name << ": " << count
+            << " entities, " << depth << " levels" << std::endl
+            << "  all dirty: " << all.first << " -> " << all.second << " ms"
+            << std::endl
+            << "  one subtree: " << subtree.first << " -> " << subtree.second
+            << " ms" << std::endl
+            << "  clean: " << clean.first << " -> " << clean.second << " ms"
+            << std::endl;
+}
+
+} // namespace
+
+void runSceneBenchmark() {
+  std::cout << "Per entity, std::vector<GameObject> -> Scene" << std::endl;
+  for (uint32_t count : {10'000u, 100'000u, 1'000'000u}) {
+    benchmarkCount(count);
+  }
+}
+
+void runHierarchyBenchmark() {
+  ThreadPool threadPool{ThreadPool::defaultThreadCount()};
+  std::cout << "Per update, single threaded -> " << threadPool.threadCount()
+            << " threads" << std::endl;
+  benchmarkHierarchy("Wide", 100, 3, 30, threadPool);
+  // Levels narrower than 8192 entities aren't split across threads, so the
+  // chains are many and short enough that every level is.
+  benchmarkHierarchy("Deep", 32768, 32, 1, threadPool);
+}
+
+} // namespace engine
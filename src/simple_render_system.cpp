@@ -1,7 +1,11 @@
 #include "simple_render_system.hpp"
-#include "gameobject.hpp"
 #include "pipeline.hpp"
+#include "swapchain.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
 #include <memory>
 #include <stdexcept>
 
@@ -14,34 +18,91 @@
 
 namespace engine {
 
-struct PushConstantData {
-  glm::mat4 transform{1.f};
-  glm::mat4 normalMatrix{1.f};
-};
-
-SimpleRenderSystem::SimpleRenderSystem(Device &device, VkRenderPass renderPass)
-    : device(device) {
-  createPipelineLayout();
-  createPipeline(renderPass);
+SimpleRenderSystem::SimpleRenderSystem(Device &device,
+                                       PipelineRegistry &pipelineRegistry,
+                                       const RenderTargetLayout &renderTarget,
+                                       VkDescriptorSetLayout globalSetLayout,
+                                       uint32_t framesInFlight)
+    : device(device), pipelineRegistry(pipelineRegistry),
+      renderTarget(renderTarget) {
+  createObjectBuffers(framesInFlight);
+  createPipelineLayout(globalSetLayout);
+  createPipeline();
 }
 
 SimpleRenderSystem::~SimpleRenderSystem() {
   vkDestroyPipelineLayout(device.device(), pipelineLayout, nullptr);
 }
 
-void SimpleRenderSystem::createPipelineLayout() {
-  VkPushConstantRange pushConstantRange{};
-  pushConstantRange.stageFlags =
-      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-  pushConstantRange.offset = 0;
-  pushConstantRange.size = sizeof(PushConstantData);
+void SimpleRenderSystem::createObjectBuffers(uint32_t framesInFlight) {
+  // One extra set for useObjectBuffer().
+  objectPool = DescriptorPool::Builder(device)
+                   .setMaxSets(framesInFlight + 1)
+                   .addPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                framesInFlight + 1)
+                   .build();
+
+  objectSetLayout = DescriptorSetLayout::Builder(device)
+                        .addBinding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                    VK_SHADER_STAGE_VERTEX_BIT)
+                        .build();
+
+  objectBuffers.resize(framesInFlight);
+  objectDescriptorSets.resize(framesInFlight);
+  uploadedVersions.resize(framesInFlight, 0);
+  for (size_t i = 0; i < objectBuffers.size(); i++) {
+    objectBuffers[i] = createObjectBuffer(INITIAL_OBJECT_CAPACITY);
+
+    auto bufferInfo = objectBuffers[i]->descriptorInfo();
+    DescriptorWriter(*objectSetLayout, *objectPool)
+        .writeBuffer(0, &bufferInfo)
+        .build(objectDescriptorSets[i]);
+  }
+}
+
+std::unique_ptr<Buffer>
+SimpleRenderSystem::createObjectBuffer(uint32_t capacity) {
+  auto buffer = std::make_unique<Buffer>(
+      device, sizeof(ObjectMatrices), capacity,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  buffer->map();
+  return buffer;
+}
+
+// Only this frame's buffer is replaced: the others may still be read by
+// frames in flight, and grow when their own frame comes around.
+void SimpleRenderSystem::growObjectBuffer(int frameIndex,
+                                          uint32_t objectCount) {
+  uint32_t capacity =
+      std::max(objectCount, 2 * objectBuffers[frameIndex]->getInstanceCount());
+  std::shared_ptr<Buffer> oldBuffer = std::move(objectBuffers[frameIndex]);
+  device.deferDestroy([retired = std::move(oldBuffer)]() mutable {
+    retired.reset();
+  });
+
+  objectBuffers[frameIndex] = createObjectBuffer(capacity);
+  auto bufferInfo = objectBuffers[frameIndex]->descriptorInfo();
+  DescriptorWriter(*objectSetLayout, *objectPool)
+      .writeBuffer(0, &bufferInfo)
+      .overwrite(objectDescriptorSets[frameIndex]);
+  // The new buffer holds nothing yet.
+  uploadedVersions[frameIndex] = 0;
+}
+
+void SimpleRenderSystem::createPipelineLayout(
+    VkDescriptorSetLayout globalSetLayout) {
+  std::array<VkDescriptorSetLayout, 2> descriptorSetLayouts{
+      globalSetLayout, objectSetLayout->getDescriptorSetLayout()};
 
   VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
   pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  pipelineLayoutInfo.setLayoutCount = 0;
-  pipelineLayoutInfo.pSetLayouts = nullptr;
-  pipelineLayoutInfo.pushConstantRangeCount = 1;
-  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+  pipelineLayoutInfo.setLayoutCount =
+      static_cast<uint32_t>(descriptorSetLayouts.size());
+  pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+  pipelineLayoutInfo.pushConstantRangeCount = 0;
+  pipelineLayoutInfo.pPushConstantRanges = nullptr;
 
   if (vkCreatePipelineLayout(device.device(), &pipelineLayoutInfo, nullptr,
                              &pipelineLayout) != VK_SUCCESS) {
@@ -49,40 +110,193 @@ void SimpleRenderSystem::createPipelineLayout() {
   }
 }
 
-void SimpleRenderSystem::createPipeline(VkRenderPass renderPass) {
+void SimpleRenderSystem::createPipeline() {
   assert(pipelineLayout != nullptr &&
          "Cannot create pipeline before pipeline layout");
 
   PipelineConfigInfo pipelineConfig{};
-  Pipeline::defaultPipelineConfigInfo(pipelineConfig);
-  pipelineConfig.renderPass = renderPass;
-  pipelineConfig.pipelineLayout = pipelineLayout;
+  shadingPipelineConfigInfo(pipelineConfig);
+
+  pipeline = pipelineRegistry.getPipeline(
+      "simple_shader.vert", "simple_shader.frag", pipelineConfig);
+}
+
+void SimpleRenderSystem::shadingPipelineConfigInfo(
+    PipelineConfigInfo &configInfo) {
+  Pipeline::defaultPipelineConfigInfo(configInfo);
+  configInfo.setRenderTarget(renderTarget);
+  configInfo.pipelineLayout = pipelineLayout;
+  configInfo.vertSpecialization.set(0, static_cast<uint32_t>(lighting.model))
+      .set(1, lighting.directionToLight.x)
+      .set(2, lighting.directionToLight.y)
+      .set(3, lighting.directionToLight.z)
+      .set(4, lighting.ambient);
+}
+
+void SimpleRenderSystem::setLighting(const Lighting &lighting) {
+  this->lighting = lighting;
+
+  PipelineConfigInfo pipelineConfig{};
+  shadingPipelineConfigInfo(pipelineConfig);
+
+  pendingPipeline = pipelineRegistry.requestPipeline(
+      "simple_shader.vert", "simple_shader.frag", pipelineConfig, pipeline);
+}
+
+void SimpleRenderSystem::update() {
+  if (!pendingPipeline) {
+    return;
+  }
+  if (pendingPipeline->isFailed()) {
+    // Keep shading with the old lighting rather than polling forever.
+    pendingPipeline = nullptr;
+    return;
+  }
+  if (!pendingPipeline->isReady()) {
+    return;
+  }
 
-  pipeline = std::make_unique<Pipeline>(
-      device, "../shaders/simple_shader.vert.spv",
-      "../shaders/simple_shader.frag.spv", pipelineConfig);
+  pipeline = pendingPipeline->getPipeline();
+  pendingPipeline = nullptr;
+  // The depth-equal variant shades too; it is requested again for the new
+  // lighting on the next pre-pass frame.
+  depthEqualPipeline = nullptr;
+  depthPrepassPipeline = nullptr;
 }
 
-void SimpleRenderSystem::renderGameObjects(VkCommandBuffer commandBuffer,
-                                           std::vector<GameObject> &gameObjects,
-                                           const Camera &camera) {
-  pipeline->bind(commandBuffer);
+bool SimpleRenderSystem::prepareDepthPrepass() {
+  if (!depthEqualPipeline) {
+    PipelineConfigInfo depthEqualConfig{};
+    shadingPipelineConfigInfo(depthEqualConfig);
+    depthEqualConfig.depthStencilInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    depthEqualConfig.depthStencilInfo.depthWriteEnable = VK_FALSE;
 
-  auto projectionView = camera.getProjection() * camera.getView();
+    depthEqualPipeline = pipelineRegistry.requestPipeline(
+        "simple_shader.vert", "simple_shader.frag", depthEqualConfig,
+        pipeline);
 
-  for (auto &obj : gameObjects) {
-    PushConstantData push{};
-    auto modelMatrix = obj.transform.mat4();
-    push.transform = projectionView * modelMatrix;
-    push.normalMatrix = obj.transform.normalMatrix();
+    PipelineConfigInfo depthPrepassConfig{};
+    Pipeline::depthOnlyPipelineConfigInfo(depthPrepassConfig);
+    depthPrepassConfig.setRenderTarget(renderTarget);
+    depthPrepassConfig.pipelineLayout = pipelineLayout;
+
+    depthPrepassPipeline = pipelineRegistry.requestPipeline(
+        "depth_prepass.vert", "", depthPrepassConfig, pipeline);
+  }
+
+  return depthEqualPipeline->isReady() && depthPrepassPipeline->isReady();
+}
+
+void SimpleRenderSystem::renderGameObjects(
+    VkCommandBuffer commandBuffer, const FrameInfo &frameInfo,
+    const Scene &scene, const std::vector<uint32_t> &entities) {
+  renderGameObjects(commandBuffer, frameInfo, scene, entities, 0,
+                    static_cast<uint32_t>(entities.size()));
+}
+
+void SimpleRenderSystem::renderGameObjects(
+    VkCommandBuffer commandBuffer, const FrameInfo &frameInfo,
+    const Scene &scene, const std::vector<uint32_t> &entities, uint32_t first,
+    uint32_t last) {
+  if (frameInfo.depthPrepass) {
+    depthEqualPipeline->bind(commandBuffer);
+  } else {
+    pipeline->bind(commandBuffer);
+  }
+
+  bindDescriptorSets(commandBuffer, frameInfo);
+  drawObjects(commandBuffer, scene, entities.data() + first, last - first);
+}
+
+void SimpleRenderSystem::renderDepthPrepass(
+    VkCommandBuffer commandBuffer, const FrameInfo &frameInfo,
+    const Scene &scene, const std::vector<uint32_t> &entities, uint32_t first,
+    uint32_t last) {
+  depthPrepassPipeline->bind(commandBuffer);
+  bindDescriptorSets(commandBuffer, frameInfo);
+  drawObjects(commandBuffer, scene, entities.data() + first, last - first);
+}
+
+void SimpleRenderSystem::useObjectBuffer(
+    VkDescriptorBufferInfo objectBufferInfo) {
+  DescriptorWriter writer{*objectSetLayout, *objectPool};
+  writer.writeBuffer(0, &objectBufferInfo);
+  if (externalObjectDescriptorSet == VK_NULL_HANDLE) {
+    writer.build(externalObjectDescriptorSet);
+  } else {
+    writer.overwrite(externalObjectDescriptorSet);
+  }
+}
+
+void SimpleRenderSystem::bindDescriptorSets(VkCommandBuffer commandBuffer,
+                                            const FrameInfo &frameInfo) {
+  std::array<VkDescriptorSet, 2> descriptorSets{
+      frameInfo.globalDescriptorSet,
+      externalObjectDescriptorSet != VK_NULL_HANDLE
+          ? externalObjectDescriptorSet
+          : objectDescriptorSets[frameInfo.frameIndex]};
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          pipelineLayout, 0,
+                          static_cast<uint32_t>(descriptorSets.size()),
+                          descriptorSets.data(), 0, nullptr);
+}
+
+void SimpleRenderSystem::uploadObjectData(int frameIndex, const Scene &scene) {
+  uploadedBytes = 0;
+  if (externalObjectDescriptorSet != VK_NULL_HANDLE) {
+    return;
+  }
+  if (scene.size() > objectBuffers[frameIndex]->getInstanceCount()) {
+    growObjectBuffer(frameIndex, scene.size());
+  }
+
+  auto *objectData = static_cast<ObjectMatrices *>(
+      objectBuffers[frameIndex]->getMappedMemory());
+  const ObjectMatrices *matrices = scene.matrices();
+  const uint64_t *versions = scene.matrixVersions();
+  uint64_t &uploadedVersion = uploadedVersions[frameIndex];
+
+  // Other frames' buffers may still be missing changes this one already
+  // has, so each buffer catches up from its own version.
+  const uint32_t count = scene.size();
+  uint32_t i = 0;
+  while (i < count) {
+    if (versions[i] <= uploadedVersion) {
+      i++;
+      continue;
+    }
+    uint32_t first = i;
+    while (i < count && versions[i] > uploadedVersion) {
+      i++;
+    }
+    std::memcpy(objectData + first, matrices + first,
+                (i - first) * sizeof(ObjectMatrices));
+    uploadedBytes += (i - first) * sizeof(ObjectMatrices);
+  }
+  uploadedVersion = scene.getMatrixVersion();
+}
 
-    vkCmdPushConstants(commandBuffer, pipelineLayout,
-                       VK_SHADER_STAGE_VERTEX_BIT |
-                           VK_SHADER_STAGE_FRAGMENT_BIT,
-                       0, sizeof(PushConstantData), &push);
+void SimpleRenderSystem::drawObjects(VkCommandBuffer commandBuffer,
+                                     const Scene &scene,
+                                     const uint32_t *entities,
+                                     uint32_t count) {
+  const auto *modelIds = scene.modelIds();
+  const auto *flags = scene.flags();
 
-    obj.model->bind(commandBuffer);
-    obj.model->draw(commandBuffer);
+  // Entities sharing a model are usually adjacent, so only rebind when the
+  // model changes.
+  Scene::ModelId boundModel = ~0u;
+  for (uint32_t k = 0; k < count; k++) {
+    uint32_t i = entities[k];
+    if (!(flags[i] & Scene::VISIBLE)) {
+      continue;
+    }
+    auto &model = scene.getModel(modelIds[i]);
+    if (modelIds[i] != boundModel) {
+      model.bind(commandBuffer);
+      boundModel = modelIds[i];
+    }
+    model.draw(commandBuffer, i);
   }
 }
 
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "buffer.hpp"
 #include "camera.hpp"
+#include "descriptors.hpp"
 #include "device.hpp"
-#include "gameobject.hpp"
+#include "frame_info.hpp"
 #include "pipeline.hpp"
+#include "pipeline_registry.hpp"
+#include "scene.hpp"
 
 #include <memory>
 #include <vector>
@@ -14,23 +18,108 @@ namespace engine {
 
 class SimpleRenderSystem {
 public:
-  SimpleRenderSystem(Device &device, VkRenderPass renderPass);
+  // Object buffers start this large and grow with the scene.
+  static constexpr uint32_t INITIAL_OBJECT_CAPACITY = 1 << 17;
+
+  // Must match LIGHTING_MODEL in simple_shader.vert.
+  enum class LightingModel : uint32_t { Unlit = 0, Lambert = 1 };
+
+  // Baked into the vertex shader as specialization constants rather than
+  // read from a uniform, so each combination is its own pipeline variant.
+  struct Lighting {
+    LightingModel model = LightingModel::Lambert;
+    glm::vec3 directionToLight = glm::normalize(glm::vec3{1.f, -3.f, -1.f});
+    float ambient = 0.1f;
+  };
+
+  SimpleRenderSystem(Device &device, PipelineRegistry &pipelineRegistry,
+                     const RenderTargetLayout &renderTarget,
+                     VkDescriptorSetLayout globalSetLayout,
+                     uint32_t framesInFlight);
   ~SimpleRenderSystem();
 
   SimpleRenderSystem(const SimpleRenderSystem &) = delete;
   SimpleRenderSystem &operator=(const SimpleRenderSystem &) = delete;
 
+  // Draws the listed entities, given by dense index, e.g. those that passed
+  // culling.
   void renderGameObjects(VkCommandBuffer commandBuffer,
-                         std::vector<GameObject> &gameObjects,
-                         const Camera &camera);
+                         const FrameInfo &frameInfo, const Scene &scene,
+                         const std::vector<uint32_t> &entities);
+  // Draws entities[first, last).
+  void renderGameObjects(VkCommandBuffer commandBuffer,
+                         const FrameInfo &frameInfo, const Scene &scene,
+                         const std::vector<uint32_t> &entities, uint32_t first,
+                         uint32_t last);
+
+  // Copies the scene's cached matrices that changed since this frame's
+  // object buffer was last written into it. Call once per frame, after
+  // Scene::updateMatrices() and before recording. The buffer is reallocated
+  // and filled again if the scene has outgrown it. Does nothing while
+  // useObjectBuffer() is in effect.
+  void uploadObjectData(int frameIndex, const Scene &scene);
+  // By the last uploadObjectData().
+  uint64_t getUploadedBytes() const { return uploadedBytes; }
+
+  // Reads model and normal matrices from this buffer (laid out like
+  // ObjectData in simple_shader.vert, indexed like the scene) instead of
+  // computing them on the CPU every frame, e.g. from GpuTransforms. Calling
+  // it again replaces the buffer, so no frame reading the old one may still
+  // be in flight.
+  void useObjectBuffer(VkDescriptorBufferInfo objectBufferInfo);
+
+  // Compiles the variant for the new lighting in the background; the
+  // current one keeps being used until update() swaps it in.
+  void setLighting(const Lighting &lighting);
+  const Lighting &getLighting() const { return lighting; }
+  // Call once per frame before recording.
+  void update();
+
+  // The depth pre-pass pipelines are compiled in the background the first
+  // time this is called. Until it returns true, frames should be rendered
+  // without the pre-pass, which is for good if either failed to compile.
+  bool prepareDepthPrepass();
+
+  // Depth-only draw of the same objects. When frameInfo.depthPrepass is set,
+  // renderGameObjects then shades with an EQUAL depth test and no depth
+  // writes, so each pixel is shaded once.
+  void renderDepthPrepass(VkCommandBuffer commandBuffer,
+                          const FrameInfo &frameInfo, const Scene &scene,
+                          const std::vector<uint32_t> &entities,
+                          uint32_t first, uint32_t last);
 
 private:
-  void createPipelineLayout();
-  void createPipeline(VkRenderPass renderPass);
+  void createObjectBuffers(uint32_t framesInFlight);
+  std::unique_ptr<Buffer> createObjectBuffer(uint32_t capacity);
+  void growObjectBuffer(int frameIndex, uint32_t objectCount);
+  void createPipelineLayout(VkDescriptorSetLayout globalSetLayout);
+  void createPipeline();
+  void shadingPipelineConfigInfo(PipelineConfigInfo &configInfo);
+  void bindDescriptorSets(VkCommandBuffer commandBuffer,
+                          const FrameInfo &frameInfo);
+  void drawObjects(VkCommandBuffer commandBuffer, const Scene &scene,
+                   const uint32_t *entities, uint32_t count);
 
   Device &device;
+  PipelineRegistry &pipelineRegistry;
+  RenderTargetLayout renderTarget;
+  Lighting lighting{};
+
+  std::unique_ptr<DescriptorPool> objectPool;
+  std::unique_ptr<DescriptorSetLayout> objectSetLayout;
+  std::vector<std::unique_ptr<Buffer>> objectBuffers;
+  std::vector<VkDescriptorSet> objectDescriptorSets;
+  // Scene matrix version each object buffer was last brought up to.
+  std::vector<uint64_t> uploadedVersions;
+  uint64_t uploadedBytes = 0;
+  VkDescriptorSet externalObjectDescriptorSet = VK_NULL_HANDLE;
 
-  std::unique_ptr<Pipeline> pipeline;
+  std::shared_ptr<Pipeline> pipeline;
+  // The variant for a lighting change, until it has compiled.
+  std::shared_ptr<AsyncPipeline> pendingPipeline;
+  // Requested by prepareDepthPrepass(); both fall back to pipeline.
+  std::shared_ptr<AsyncPipeline> depthEqualPipeline;
+  std::shared_ptr<AsyncPipeline> depthPrepassPipeline;
   VkPipelineLayout pipelineLayout;
 };
 
@@ -0,0 +1,75 @@
+#include "simulation.hpp"
+
+namespace engine {
+
+Simulation::Simulation(const TransformComponent &viewer,
+                       const KeyboardMovementController &controller)
+    : controller{controller}, viewer{viewer} {
+  // Step 0 is the initial state, so the first frame has a snapshot.
+  auto &initial = snapshots.writeBuffer();
+  initial.viewer = viewer;
+  snapshots.publish();
+
+  thread = std::thread{[this] { run(); }};
+}
+
+Simulation::~Simulation() {
+  stopping = true;
+  thread.join();
+}
+
+void Simulation::publishInput(const KeyboardMovementController::Input &input) {
+  inputs.writeBuffer() = input;
+  inputs.publish();
+}
+
+const FrameSnapshot &Simulation::acquireSnapshot() {
+  requestedStep.fetch_add(1, std::memory_order_release);
+  snapshots.update();
+  return snapshots.readBuffer();
+}
+
+// Steps are requested once per frame, so a short wait is the common case:
+// spin briefly, then back off to sleeping.
+void Simulation::waitForRequest(uint64_t step) {
+  constexpr int SPIN_COUNT = 64;
+  constexpr std::chrono::microseconds BACKOFF{100};
+
+  int spins = 0;
+  while (requestedStep.load(std::memory_order_acquire) < step && !stopping) {
+    if (spins++ < SPIN_COUNT) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(BACKOFF);
+    }
+  }
+}
+
+void Simulation::run() {
+  auto lastStepTime = Clock::now();
+  for (uint64_t step = 1;; step++) {
+    waitForRequest(step);
+    if (stopping) {
+      return;
+    }
+
+    auto start = Clock::now();
+    float frameTime =
+        std::chrono::duration<float>(start - lastStepTime).count();
+    lastStepTime = start;
+
+    inputs.update();
+    controller.applyInput(inputs.readBuffer(), frameTime, viewer);
+
+    auto &snapshot = snapshots.writeBuffer();
+    snapshot.step = step;
+    snapshot.frameTime = frameTime;
+    snapshot.viewer = viewer;
+    snapshot.stepTimeMs =
+        std::chrono::duration<float, std::milli>(Clock::now() - start)
+            .count();
+    snapshots.publish();
+  }
+}
+
+} // namespace engine
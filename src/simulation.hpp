@@ -0,0 +1,63 @@
+#pragma once
+
+#include "gameobject.hpp"
+#include "keyboard_movement_controller.hpp"
+#include "triple_buffer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace engine {
+
+// Everything the render thread needs from one simulation step. Never
+// modified after it is published. Holds full state rather than changes,
+// since snapshots the render thread didn't get to are overwritten.
+struct FrameSnapshot {
+  uint64_t step = 0;
+  float frameTime = 0.f;
+  TransformComponent viewer{};
+  // CPU time the step took on the simulation thread.
+  float stepTimeMs = 0.f;
+};
+
+// Runs simulation steps on a thread of its own, one step per rendered
+// frame: while the render thread records frame N from snapshot N, step N+1
+// is computed. Input, snapshots and step requests are handed over through
+// triple buffers and atomics, without locks.
+class Simulation {
+public:
+  Simulation(const TransformComponent &viewer,
+             const KeyboardMovementController &controller);
+  ~Simulation();
+
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+
+  // Main thread. The latest input is used by the next step.
+  void publishInput(const KeyboardMovementController::Input &input);
+
+  // Render thread, once per frame. Requests the next step and returns the
+  // newest finished snapshot, which stays valid until the next call.
+  const FrameSnapshot &acquireSnapshot();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  void run();
+  void waitForRequest(uint64_t step);
+
+  KeyboardMovementController controller;
+  // Owned by the simulation thread once it starts.
+  TransformComponent viewer;
+
+  TripleBuffer<KeyboardMovementController::Input> inputs;
+  TripleBuffer<FrameSnapshot> snapshots;
+
+  std::atomic<uint64_t> requestedStep{0};
+  std::atomic<bool> stopping{false};
+  std::thread thread;
+};
+
+} // namespace engine
@@ -1,5 +1,6 @@
 #include "swapchain.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cstdlib>
 #include <cstring>
@@ -11,6 +12,34 @@
 
 namespace engine {
 
+static VkPresentModeKHR toVkPresentMode(SwapChain::PresentMode presentMode) {
+  switch (presentMode) {
+  case SwapChain::FIFO:
+    return VK_PRESENT_MODE_FIFO_KHR;
+  case SwapChain::FIFO_RELAXED:
+    return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+  case SwapChain::MAILBOX:
+    return VK_PRESENT_MODE_MAILBOX_KHR;
+  case SwapChain::IMMEDIATE:
+    return VK_PRESENT_MODE_IMMEDIATE_KHR;
+  }
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+const char *SwapChain::presentModeName(PresentMode presentMode) {
+  switch (presentMode) {
+  case FIFO:
+    return "FIFO";
+  case FIFO_RELAXED:
+    return "FIFO_RELAXED";
+  case MAILBOX:
+    return "MAILBOX";
+  case IMMEDIATE:
+    return "IMMEDIATE";
+  }
+  return "UNKNOWN";
+}
+
 SwapChain::SwapChain(Device &deviceRef, VkExtent2D extent,
                      PresentMode presentMode)
     : device{deviceRef}, windowExtent{extent}, presentMode{presentMode} {
@@ -18,9 +47,10 @@ SwapChain::SwapChain(Device &deviceRef, VkExtent2D extent,
 }
 
 SwapChain::SwapChain(Device &deviceRef, VkExtent2D extent,
-                     std::shared_ptr<SwapChain> previous)
+                     std::shared_ptr<SwapChain> previous,
+                     PresentMode presentMode)
     : device{deviceRef}, windowExtent{extent}, oldSwapChain{previous},
-      presentMode{previous->presentMode} {
+      presentMode{presentMode} {
   init();
   oldSwapChain = nullptr;
 }
@@ -28,9 +58,18 @@ SwapChain::SwapChain(Device &deviceRef, VkExtent2D extent,
 void SwapChain::init() {
   createSwapChain();
   createImageViews();
-  createRenderPass();
-  createDepthResources();
-  createFramebuffers();
+  swapChainDepthFormat = findDepthFormat();
+  // With dynamic rendering pipelines only depend on the formats.
+  if (!device.supportsDynamicRendering()) {
+    if (oldSwapChain != nullptr && compareSwapFormats(*oldSwapChain)) {
+      // Same attachment formats, so the old render pass is still valid and
+      // pipelines built against it stay compatible. Take ownership of it.
+      renderPass = oldSwapChain->renderPass;
+      oldSwapChain->renderPass = VK_NULL_HANDLE;
+    } else {
+      createRenderPass();
+    }
+  }
   createSyncObjects();
 }
 
@@ -45,87 +84,57 @@ SwapChain::~SwapChain() {
     swapChain = nullptr;
   }
 
-  for (int i = 0; i < depthImages.size(); i++) {
-    vkDestroyImageView(device.device(), depthImageViews[i], nullptr);
-    vkDestroyImage(device.device(), depthImages[i], nullptr);
-    vkFreeMemory(device.device(), depthImageMemorys[i], nullptr);
+  if (renderPass != VK_NULL_HANDLE) {
+    vkDestroyRenderPass(device.device(), renderPass, nullptr);
   }
 
-  for (auto framebuffer : swapChainFramebuffers) {
-    vkDestroyFramebuffer(device.device(), framebuffer, nullptr);
-  }
-
-  vkDestroyRenderPass(device.device(), renderPass, nullptr);
-
   // cleanup synchronization objects
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(device.device(), renderFinishedSemaphores[i], nullptr);
-    vkDestroySemaphore(device.device(), imageAvailableSemaphores[i], nullptr);
-    vkDestroyFence(device.device(), inFlightFences[i], nullptr);
+  for (auto semaphore : renderFinishedSemaphores) {
+    vkDestroySemaphore(device.device(), semaphore, nullptr);
   }
 }
 
-VkResult SwapChain::acquireNextImage(uint32_t *imageIndex) {
-  vkWaitForFences(device.device(), 1, &inFlightFences[currentFrame], VK_TRUE,
-                  std::numeric_limits<uint64_t>::max());
-
-  VkResult result = vkAcquireNextImageKHR(
-      device.device(), swapChain, std::numeric_limits<uint64_t>::max(),
-      imageAvailableSemaphores[currentFrame], // must be a not signaled
-                                              // semaphore
-      VK_NULL_HANDLE, imageIndex);
-
-  return result;
+VkResult SwapChain::acquireNextImage(VkSemaphore imageAvailable,
+                                     uint32_t *imageIndex) {
+  return vkAcquireNextImageKHR(device.device(), swapChain,
+                               std::numeric_limits<uint64_t>::max(),
+                               imageAvailable, // must be a not signaled
+                                               // semaphore
+                               VK_NULL_HANDLE, imageIndex);
 }
 
-VkResult SwapChain::submitCommandBuffers(const VkCommandBuffer *buffers,
-                                         uint32_t *imageIndex) {
-  if (imagesInFlight[*imageIndex] != VK_NULL_HANDLE) {
-    vkWaitForFences(device.device(), 1, &imagesInFlight[*imageIndex], VK_TRUE,
-                    UINT64_MAX);
-  }
-  imagesInFlight[*imageIndex] = inFlightFences[currentFrame];
-
-  VkSubmitInfo submitInfo = {};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-  VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-  VkPipelineStageFlags waitStages[] = {
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
-
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = buffers;
-
-  VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphores;
-
-  vkResetFences(device.device(), 1, &inFlightFences[currentFrame]);
-  if (vkQueueSubmit(device.graphicsQueue(), 1, &submitInfo,
-                    inFlightFences[currentFrame]) != VK_SUCCESS) {
-    throw std::runtime_error("failed to submit draw command buffer!");
-  }
-
+VkResult SwapChain::present(uint32_t imageIndex, uint64_t presentId) {
   VkPresentInfoKHR presentInfo = {};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 
+  VkPresentIdKHR presentIdInfo = {};
+  if (presentId != 0) {
+    if (firstPresentId == 0) {
+      firstPresentId = presentId;
+    }
+    presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+    presentIdInfo.swapchainCount = 1;
+    presentIdInfo.pPresentIds = &presentId;
+    presentInfo.pNext = &presentIdInfo;
+  }
+
   presentInfo.waitSemaphoreCount = 1;
-  presentInfo.pWaitSemaphores = signalSemaphores;
+  presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
 
   VkSwapchainKHR swapChains[] = {swapChain};
   presentInfo.swapchainCount = 1;
   presentInfo.pSwapchains = swapChains;
 
-  presentInfo.pImageIndices = imageIndex;
-
-  auto result = vkQueuePresentKHR(device.presentQueue(), &presentInfo);
+  presentInfo.pImageIndices = &imageIndex;
 
-  currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+  return vkQueuePresentKHR(device.presentQueue(), &presentInfo);
+}
 
-  return result;
+VkResult SwapChain::waitForPresent(uint64_t presentId, uint64_t timeout) {
+  if (firstPresentId == 0 || presentId < firstPresentId) {
+    return VK_SUCCESS;
+  }
+  return device.waitForPresent(swapChain, presentId, timeout);
 }
 
 void SwapChain::createSwapChain() {
@@ -153,6 +162,12 @@ void SwapChain::createSwapChain() {
   createInfo.imageExtent = extent;
   createInfo.imageArrayLayers = 1;
   createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  // Lets frames be copied out for capture, and scaled frames be blitted
+  // in.
+  createInfo.imageUsage |= swapChainSupport.capabilities.supportedUsageFlags &
+                           (VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                            VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+  imageUsage = createInfo.imageUsage;
 
   QueueFamilyIndices indices = device.findPhysicalQueueFamilies();
   uint32_t queueFamilyIndices[] = {indices.graphicsFamily,
@@ -217,9 +232,12 @@ void SwapChain::createImageViews() {
   }
 }
 
+// Render passes are built by the render graph each frame. This one is never
+// begun; it only describes the swap chain attachments so that pipelines can
+// be created against a compatible render pass.
 void SwapChain::createRenderPass() {
   VkAttachmentDescription depthAttachment{};
-  depthAttachment.format = findDepthFormat();
+  depthAttachment.format = swapChainDepthFormat;
   depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
   depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
@@ -253,17 +271,6 @@ void SwapChain::createRenderPass() {
   subpass.pColorAttachments = &colorAttachmentRef;
   subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-  VkSubpassDependency dependency = {};
-  dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-  dependency.srcAccessMask = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  dependency.dstSubpass = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
-                            VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
-                             VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
   std::array<VkAttachmentDescription, 2> attachments = {colorAttachment,
                                                         depthAttachment};
   VkRenderPassCreateInfo renderPassInfo = {};
@@ -272,8 +279,6 @@ void SwapChain::createRenderPass() {
   renderPassInfo.pAttachments = attachments.data();
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subpass;
-  renderPassInfo.dependencyCount = 1;
-  renderPassInfo.pDependencies = &dependency;
 
   if (vkCreateRenderPass(device.device(), &renderPassInfo, nullptr,
                          &renderPass) != VK_SUCCESS) {
@@ -281,96 +286,15 @@ void SwapChain::createRenderPass() {
   }
 }
 
-void SwapChain::createFramebuffers() {
-  swapChainFramebuffers.resize(imageCount());
-  for (size_t i = 0; i < imageCount(); i++) {
-    std::array<VkImageView, 2> attachments = {swapChainImageViews[i],
-                                              depthImageViews[i]};
-
-    VkExtent2D swapChainExtent = getSwapChainExtent();
-    VkFramebufferCreateInfo framebufferInfo = {};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = renderPass;
-    framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-    framebufferInfo.pAttachments = attachments.data();
-    framebufferInfo.width = swapChainExtent.width;
-    framebufferInfo.height = swapChainExtent.height;
-    framebufferInfo.layers = 1;
-
-    if (vkCreateFramebuffer(device.device(), &framebufferInfo, nullptr,
-                            &swapChainFramebuffers[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create framebuffer!");
-    }
-  }
-}
-
-void SwapChain::createDepthResources() {
-  VkFormat depthFormat = findDepthFormat();
-  swapChainDepthFormat = depthFormat;
-  VkExtent2D swapChainExtent = getSwapChainExtent();
-
-  depthImages.resize(imageCount());
-  depthImageMemorys.resize(imageCount());
-  depthImageViews.resize(imageCount());
-
-  for (int i = 0; i < depthImages.size(); i++) {
-    VkImageCreateInfo imageInfo{};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = swapChainExtent.width;
-    imageInfo.extent.height = swapChainExtent.height;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.format = depthFormat;
-    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    imageInfo.flags = 0;
-
-    device.createImageWithInfo(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                               depthImages[i], depthImageMemorys[i]);
-
-    VkImageViewCreateInfo viewInfo{};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = depthImages[i];
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = depthFormat;
-    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = 1;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
-
-    if (vkCreateImageView(device.device(), &viewInfo, nullptr,
-                          &depthImageViews[i]) != VK_SUCCESS) {
-      throw std::runtime_error("failed to create texture image view!");
-    }
-  }
-}
-
 void SwapChain::createSyncObjects() {
-  imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-  inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-  imagesInFlight.resize(imageCount(), VK_NULL_HANDLE);
+  renderFinishedSemaphores.resize(imageCount());
 
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-  VkFenceCreateInfo fenceInfo = {};
-  fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-  for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+  for (auto &semaphore : renderFinishedSemaphores) {
     if (vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr,
-                          &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-        vkCreateSemaphore(device.device(), &semaphoreInfo, nullptr,
-                          &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-        vkCreateFence(device.device(), &fenceInfo, nullptr,
-                      &inFlightFences[i]) != VK_SUCCESS) {
+                          &semaphore) != VK_SUCCESS) {
       throw std::runtime_error(
           "failed to create synchronization objects for a frame!");
     }
@@ -391,27 +315,30 @@ VkSurfaceFormatKHR SwapChain::chooseSwapSurfaceFormat(
 
 VkPresentModeKHR SwapChain::chooseSwapPresentMode(
     const std::vector<VkPresentModeKHR> &availablePresentModes) {
-  VkPresentModeKHR vkChosenPresentMode;
-  if (presentMode == FIFO) {
-    vkChosenPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-  } else if (presentMode == MAILBOX) {
-    vkChosenPresentMode = VK_PRESENT_MODE_MAILBOX_KHR;
-  } else if (presentMode == IMMEDIATE) {
-    vkChosenPresentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
-  }
+  VkPresentModeKHR vkChosenPresentMode = toVkPresentMode(presentMode);
 
   for (const auto &availablePresentMode : availablePresentModes) {
     if (availablePresentMode == vkChosenPresentMode) {
-      std::cout << "Chosen present mode is available!" << std::endl;
+      std::cout << "Present mode: " << presentModeName(presentMode)
+                << std::endl;
+      activePresentMode = presentMode;
       return vkChosenPresentMode;
     }
   }
 
-  std::cerr << "Chosen present mode is not available! FIFO will be used"
-            << std::endl;
+  // FIFO is the only mode every surface has to support.
+  std::cerr << "Present mode " << presentModeName(presentMode)
+            << " is not available! FIFO will be used" << std::endl;
+  activePresentMode = FIFO;
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+bool SwapChain::isPresentModeSupported(PresentMode presentMode) {
+  auto presentModes = device.getSwapChainSupport().presentModes;
+  return std::find(presentModes.begin(), presentModes.end(),
+                   toVkPresentMode(presentMode)) != presentModes.end();
+}
+
 VkExtent2D
 SwapChain::chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities) {
   if (capabilities.currentExtent.width !=
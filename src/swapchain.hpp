@@ -11,26 +11,33 @@ namespace engine {
 
 class SwapChain {
 public:
-  enum PresentMode { FIFO, MAILBOX, IMMEDIATE };
+  enum PresentMode { FIFO, FIFO_RELAXED, MAILBOX, IMMEDIATE };
 
-  static constexpr int MAX_FRAMES_IN_FLIGHT = 2;
+  static const char *presentModeName(PresentMode presentMode);
 
   SwapChain(Device &deviceRef, VkExtent2D extent, PresentMode presentMode);
   SwapChain(Device &deviceRef, VkExtent2D extent,
-            std::shared_ptr<SwapChain> previous);
+            std::shared_ptr<SwapChain> previous, PresentMode presentMode);
   ~SwapChain();
 
   SwapChain(const SwapChain &) = delete;
   SwapChain &operator=(const SwapChain &) = delete;
 
-  VkFramebuffer getFrameBuffer(int index) {
-    return swapChainFramebuffers[index];
-  }
+  // Compatible with the render passes the render graph builds for a color
+  // attachment in the swap chain format followed by a depth attachment.
+  // Null with dynamic rendering.
   VkRenderPass getRenderPass() { return renderPass; }
+  VkImage getImage(int index) { return swapChainImages[index]; }
   VkImageView getImageView(int index) { return swapChainImageViews[index]; }
   size_t imageCount() { return swapChainImages.size(); }
   VkFormat getSwapChainImageFormat() { return swapChainImageFormat; }
+  VkFormat getSwapChainDepthFormat() { return swapChainDepthFormat; }
   VkExtent2D getSwapChainExtent() { return swapChainExtent; }
+  VkImageUsageFlags getImageUsage() { return imageUsage; }
+  // The mode actually in use, which is FIFO when the requested one isn't
+  // supported by the surface.
+  PresentMode getPresentMode() { return activePresentMode; }
+  bool isPresentModeSupported(PresentMode presentMode);
   uint32_t width() { return swapChainExtent.width; }
   uint32_t height() { return swapChainExtent.height; }
 
@@ -40,9 +47,20 @@ public:
   }
   VkFormat findDepthFormat();
 
-  VkResult acquireNextImage(uint32_t *imageIndex);
-  VkResult submitCommandBuffers(const VkCommandBuffer *buffers,
-                                uint32_t *imageIndex);
+  // imageAvailable is signaled once the image can be rendered to.
+  VkResult acquireNextImage(VkSemaphore imageAvailable, uint32_t *imageIndex);
+  // The submission rendering to an image must signal this semaphore; present
+  // waits on it. One per image, since an image is only re-acquired after its
+  // previous present has consumed the semaphore.
+  VkSemaphore getRenderFinishedSemaphore(uint32_t imageIndex) {
+    return renderFinishedSemaphores[imageIndex];
+  }
+  // A non-zero presentId tags the present for waitForPresent and must
+  // increase with every present on this swap chain.
+  VkResult present(uint32_t imageIndex, uint64_t presentId = 0);
+  // Waits until the present tagged presentId (or a later one) has been
+  // displayed. Ids presented on an earlier swap chain count as displayed.
+  VkResult waitForPresent(uint64_t presentId, uint64_t timeout);
 
   bool compareSwapFormats(const SwapChain &swapChain) const {
     return swapChain.swapChainDepthFormat == swapChainDepthFormat &&
@@ -53,12 +71,11 @@ private:
   void init();
   void createSwapChain();
   void createImageViews();
-  void createDepthResources();
   void createRenderPass();
-  void createFramebuffers();
   void createSyncObjects();
 
   PresentMode presentMode;
+  PresentMode activePresentMode = FIFO;
 
   VkSurfaceFormatKHR chooseSwapSurfaceFormat(
       const std::vector<VkSurfaceFormatKHR> &availableFormats);
@@ -69,13 +86,10 @@ private:
   VkFormat swapChainImageFormat;
   VkFormat swapChainDepthFormat;
   VkExtent2D swapChainExtent;
+  VkImageUsageFlags imageUsage = 0;
 
-  std::vector<VkFramebuffer> swapChainFramebuffers;
-  VkRenderPass renderPass;
+  VkRenderPass renderPass = VK_NULL_HANDLE;
 
-  std::vector<VkImage> depthImages;
-  std::vector<VkDeviceMemory> depthImageMemorys;
-  std::vector<VkImageView> depthImageViews;
   std::vector<VkImage> swapChainImages;
   std::vector<VkImageView> swapChainImageViews;
 
@@ -85,11 +99,8 @@ private:
   VkSwapchainKHR swapChain;
   std::shared_ptr<SwapChain> oldSwapChain;
 
-  std::vector<VkSemaphore> imageAvailableSemaphores;
   std::vector<VkSemaphore> renderFinishedSemaphores;
-  std::vector<VkFence> inFlightFences;
-  std::vector<VkFence> imagesInFlight;
-  size_t currentFrame = 0;
+  uint64_t firstPresentId = 0;
 };
 
 } // namespace engine
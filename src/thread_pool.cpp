@@ -0,0 +1,84 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace engine {
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+  threadCount = std::max(threadCount, 1u);
+  workers.reserve(threadCount);
+  for (uint32_t i = 0; i < threadCount; i++) {
+    workers.emplace_back([this] { workerLoop(); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    stopping = true;
+  }
+  taskAvailable.notify_all();
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+uint32_t ThreadPool::defaultThreadCount() {
+  return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    tasks.push(std::move(task));
+    pendingTasks++;
+  }
+  taskAvailable.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock{mutex};
+  tasksFinished.wait(lock, [this] { return pendingTasks == 0; });
+
+  if (firstError) {
+    auto error = firstError;
+    firstError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void ThreadPool::workerLoop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      taskAvailable.wait(lock, [this] { return stopping || !tasks.empty(); });
+      if (stopping && tasks.empty()) {
+        return;
+      }
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+
+    std::exception_ptr error;
+    try {
+      task();
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      if (error && !firstError) {
+        firstError = error;
+      }
+      pendingTasks--;
+      if (pendingTasks == 0) {
+        tasksFinished.notify_all();
+      }
+    }
+  }
+}
+
+} // namespace engine
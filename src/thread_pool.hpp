@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace engine {
+
+class ThreadPool {
+public:
+  explicit ThreadPool(uint32_t threadCount);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  static uint32_t defaultThreadCount();
+
+  uint32_t threadCount() const { return static_cast<uint32_t>(workers.size()); }
+
+  void submit(std::function<void()> task);
+
+  // Blocks until every submitted task has finished. The first exception
+  // thrown by a task is rethrown here.
+  void wait();
+
+private:
+  void workerLoop();
+
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()>> tasks;
+
+  std::mutex mutex;
+  std::condition_variable taskAvailable;
+  std::condition_variable tasksFinished;
+  size_t pendingTasks = 0;
+  std::exception_ptr firstError;
+  bool stopping = false;
+};
+
+} // namespace engine
@@ -0,0 +1,319 @@
+#include "transform_batch.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ENGINE_TRANSFORM_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENGINE_TRANSFORM_SSE2
+#endif
+
+namespace engine {
+
+namespace {
+
+constexpr size_t MATRICES_STRIDE = sizeof(ObjectMatrices) / sizeof(float);
+constexpr size_t NORMAL_MATRIX_OFFSET =
+    offsetof(ObjectMatrices, normalMatrix) / sizeof(float);
+
+// Each backend provides the same operations on a register of WIDTH floats
+// (F) or 32-bit integers (I), so the kernel below is written once.
+struct ScalarOps {
+  static constexpr uint32_t WIDTH = 1;
+  using F = float;
+  using I = int32_t;
+
+  static F set1(float value) { return value; }
+  static F add(F a, F b) { return a + b; }
+  static F sub(F a, F b) { return a - b; }
+  static F mul(F a, F b) { return a * b; }
+  static F div(F a, F b) { return a / b; }
+  static F abs(F a) { return fromBits(toBits(a) & 0x7fffffffu); }
+  static F signBit(F a) { return fromBits(toBits(a) & 0x80000000u); }
+  static F bitXor(F a, F b) { return fromBits(toBits(a) ^ toBits(b)); }
+  static F select(F mask, F a, F b) { return toBits(mask) ? a : b; }
+
+  static I truncate(F a) { return static_cast<I>(a); }
+  static F toFloat(I a) { return static_cast<F>(a); }
+  static I addInt(I a, int32_t b) { return a + b; }
+  static I andInt(I a, int32_t b) { return a & b; }
+  static I notInt(I a) { return ~a; }
+  static F isZero(I a) { return fromBits(a == 0 ? ~0u : 0u); }
+  // Moves bit 2 into the sign bit.
+  static F bit2ToSign(I a) { return fromBits(static_cast<uint32_t>(a) << 29); }
+
+  static void load3(const glm::vec3 *values, F &x, F &y, F &z) {
+    x = values->x;
+    y = values->y;
+    z = values->z;
+  }
+  static void store4(float *dst, F a, F b, F c, F d) {
+    dst[0] = a;
+    dst[1] = b;
+    dst[2] = c;
+    dst[3] = d;
+  }
+
+  static uint32_t toBits(F a) {
+    uint32_t bits;
+    std::memcpy(&bits, &a, sizeof(bits));
+    return bits;
+  }
+  static F fromBits(uint32_t bits) {
+    F a;
+    std::memcpy(&a, &bits, sizeof(a));
+    return a;
+  }
+};
+
+#ifdef ENGINE_TRANSFORM_SSE2
+struct Sse2Ops {
+  static constexpr uint32_t WIDTH = 4;
+  using F = __m128;
+  using I = __m128i;
+
+  static F set1(float value) { return _mm_set1_ps(value); }
+  static F add(F a, F b) { return _mm_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm_div_ps(a, b); }
+  static F abs(F a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a); }
+  static F signBit(F a) { return _mm_and_ps(_mm_set1_ps(-0.f), a); }
+  static F bitXor(F a, F b) { return _mm_xor_ps(a, b); }
+  static F select(F mask, F a, F b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+  }
+
+  static I truncate(F a) { return _mm_cvttps_epi32(a); }
+  static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+  static I addInt(I a, int32_t b) {
+    return _mm_add_epi32(a, _mm_set1_epi32(b));
+  }
+  static I andInt(I a, int32_t b) {
+    return _mm_and_si128(a, _mm_set1_epi32(b));
+  }
+  static I notInt(I a) { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+  static F isZero(I a) {
+    return _mm_castsi128_ps(_mm_cmpeq_epi32(a, _mm_setzero_si128()));
+  }
+  static F bit2ToSign(I a) { return _mm_castsi128_ps(_mm_slli_epi32(a, 29)); }
+
+  // Splits 4 packed vec3s into x, y and z registers.
+  static void load3(const glm::vec3 *values, F &x, F &y, F &z) {
+    const float *floats = &values->x;
+    F x0y0z0x1 = _mm_loadu_ps(floats);
+    F y1z1x2y2 = _mm_loadu_ps(floats + 4);
+    F z2x3y3z3 = _mm_loadu_ps(floats + 8);
+    F x2y2x3y3 = _mm_shuffle_ps(y1z1x2y2, z2x3y3z3, _MM_SHUFFLE(2, 1, 3, 2));
+    F y0z0y1z1 = _mm_shuffle_ps(x0y0z0x1, y1z1x2y2, _MM_SHUFFLE(1, 0, 2, 1));
+    x = _mm_shuffle_ps(x0y0z0x1, x2y2x3y3, _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm_shuffle_ps(y0z0y1z1, x2y2x3y3, _MM_SHUFFLE(3, 1, 2, 0));
+    z = _mm_shuffle_ps(y0z0y1z1, z2x3y3z3, _MM_SHUFFLE(3, 0, 3, 1));
+  }
+  // Writes (a, b, c, d) of object i to dst + i * MATRICES_STRIDE.
+  static void store4(float *dst, F a, F b, F c, F d) {
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    _mm_storeu_ps(dst, a);
+    _mm_storeu_ps(dst + MATRICES_STRIDE, b);
+    _mm_storeu_ps(dst + 2 * MATRICES_STRIDE, c);
+    _mm_storeu_ps(dst + 3 * MATRICES_STRIDE, d);
+  }
+};
+#endif
+
+#ifdef ENGINE_TRANSFORM_AVX2
+struct Avx2Ops {
+  static constexpr uint32_t WIDTH = 8;
+  using F = __m256;
+  using I = __m256i;
+
+  static F set1(float value) { return _mm256_set1_ps(value); }
+  static F add(F a, F b) { return _mm256_add_ps(a, b); }
+  static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+  static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+  static F div(F a, F b) { return _mm256_div_ps(a, b); }
+  static F abs(F a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a); }
+  static F signBit(F a) { return _mm256_and_ps(_mm256_set1_ps(-0.f), a); }
+  static F bitXor(F a, F b) { return _mm256_xor_ps(a, b); }
+  static F select(F mask, F a, F b) { return _mm256_blendv_ps(b, a, mask); }
+
+  static I truncate(F a) { return _mm256_cvttps_epi32(a); }
+  static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+  static I addInt(I a, int32_t b) {
+    return _mm256_add_epi32(a, _mm256_set1_epi32(b));
+  }
+  static I andInt(I a, int32_t b) {
+    return _mm256_and_si256(a, _mm256_set1_epi32(b));
+  }
+  static I notInt(I a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+  static F isZero(I a) {
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, _mm256_setzero_si256()));
+  }
+  static F bit2ToSign(I a) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(a, 29));
+  }
+
+  static void load3(const glm::vec3 *values, F &x, F &y, F &z) {
+    __m128 x0, y0, z0, x1, y1, z1;
+    Sse2Ops::load3(values, x0, y0, z0);
+    Sse2Ops::load3(values + 4, x1, y1, z1);
+    x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+    y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+    z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+  }
+  static void store4(float *dst, F a, F b, F c, F d) {
+    Sse2Ops::store4(dst, _mm256_castps256_ps128(a), _mm256_castps256_ps128(b),
+                    _mm256_castps256_ps128(c), _mm256_castps256_ps128(d));
+    Sse2Ops::store4(dst + 4 * MATRICES_STRIDE, _mm256_extractf128_ps(a, 1),
+                    _mm256_extractf128_ps(b, 1), _mm256_extractf128_ps(c, 1),
+                    _mm256_extractf128_ps(d, 1));
+  }
+};
+#endif
+
+// Sine and cosine together, from the single precision Cephes polynomials:
+// the angle is reduced to [-pi/4, pi/4] by its octant, which also picks
+// which polynomial gives the sine and which the cosine, and their signs.
+template <typename Ops>
+void sincos(typename Ops::F x, typename Ops::F &sine, typename Ops::F &cosine) {
+  using F = typename Ops::F;
+  using I = typename Ops::I;
+
+  F sineSign = Ops::signBit(x);
+  x = Ops::abs(x);
+
+  // Octant, rounded up to even.
+  I octant = Ops::truncate(Ops::mul(x, Ops::set1(1.27323954473516f)));
+  octant = Ops::andInt(Ops::addInt(octant, 1), ~1);
+  F y = Ops::toFloat(octant);
+
+  sineSign = Ops::bitXor(sineSign, Ops::bit2ToSign(Ops::andInt(octant, 4)));
+  F cosineSign = Ops::bit2ToSign(
+      Ops::andInt(Ops::notInt(Ops::addInt(octant, -2)), 4));
+  // Where set, the sine comes from the sine polynomial.
+  F sinePolynomial = Ops::isZero(Ops::andInt(octant, 2));
+
+  // x - y * pi/4 in three steps, to keep the precision of pi/4.
+  x = Ops::sub(x, Ops::mul(y, Ops::set1(0.78515625f)));
+  x = Ops::sub(x, Ops::mul(y, Ops::set1(2.4187564849853515625e-4f)));
+  x = Ops::sub(x, Ops::mul(y, Ops::set1(3.77489497744594108e-8f)));
+  F z = Ops::mul(x, x);
+
+  F c = Ops::set1(2.443315711809948e-5f);
+  c = Ops::add(Ops::mul(c, z), Ops::set1(-1.388731625493765e-3f));
+  c = Ops::add(Ops::mul(c, z), Ops::set1(4.166664568298827e-2f));
+  c = Ops::mul(Ops::mul(c, z), z);
+  c = Ops::sub(c, Ops::mul(z, Ops::set1(0.5f)));
+  c = Ops::add(c, Ops::set1(1.f));
+
+  F s = Ops::set1(-1.9515295891e-4f);
+  s = Ops::add(Ops::mul(s, z), Ops::set1(8.3321608736e-3f));
+  s = Ops::add(Ops::mul(s, z), Ops::set1(-1.6666654611e-1f));
+  s = Ops::add(Ops::mul(Ops::mul(s, z), x), x);
+
+  sine = Ops::bitXor(Ops::select(sinePolynomial, s, c), sineSign);
+  cosine = Ops::bitXor(Ops::select(sinePolynomial, c, s), cosineSign);
+}
+
+// Ops::WIDTH objects, with the same rotation (Tait-Bryan Y1 X2 Z3) as
+// TransformComponent::mat4().
+template <typename Ops>
+void computeBatch(const glm::vec3 *translations, const glm::vec3 *rotations,
+                  const glm::vec3 *scales, ObjectMatrices *matrices) {
+  using F = typename Ops::F;
+
+  F tx, ty, tz, rx, ry, rz, sx, sy, sz;
+  Ops::load3(translations, tx, ty, tz);
+  Ops::load3(rotations, rx, ry, rz);
+  Ops::load3(scales, sx, sy, sz);
+
+  F s1, c1, s2, c2, s3, c3;
+  sincos<Ops>(ry, s1, c1);
+  sincos<Ops>(rx, s2, c2);
+  sincos<Ops>(rz, s3, c3);
+
+  const F s1s2 = Ops::mul(s1, s2);
+  const F c1s2 = Ops::mul(c1, s2);
+  const F r00 = Ops::add(Ops::mul(c1, c3), Ops::mul(s1s2, s3));
+  const F r01 = Ops::mul(c2, s3);
+  const F r02 = Ops::sub(Ops::mul(c1s2, s3), Ops::mul(c3, s1));
+  const F r10 = Ops::sub(Ops::mul(c3, s1s2), Ops::mul(c1, s3));
+  const F r11 = Ops::mul(c2, c3);
+  const F r12 = Ops::add(Ops::mul(c3, c1s2), Ops::mul(s1, s3));
+  const F r20 = Ops::mul(c2, s1);
+  const F r21 = Ops::sub(Ops::set1(0.f), s2);
+  const F r22 = Ops::mul(c1, c2);
+
+  const F zero = Ops::set1(0.f);
+  const F one = Ops::set1(1.f);
+
+  float *model = &matrices->modelMatrix[0][0];
+  Ops::store4(model, Ops::mul(sx, r00), Ops::mul(sx, r01), Ops::mul(sx, r02),
+              zero);
+  Ops::store4(model + 4, Ops::mul(sy, r10), Ops::mul(sy, r11),
+              Ops::mul(sy, r12), zero);
+  Ops::store4(model + 8, Ops::mul(sz, r20), Ops::mul(sz, r21),
+              Ops::mul(sz, r22), zero);
+  Ops::store4(model + 12, tx, ty, tz, one);
+
+  const F ix = Ops::div(one, sx);
+  const F iy = Ops::div(one, sy);
+  const F iz = Ops::div(one, sz);
+
+  float *normal = model + NORMAL_MATRIX_OFFSET;
+  Ops::store4(normal, Ops::mul(ix, r00), Ops::mul(ix, r01), Ops::mul(ix, r02),
+              zero);
+  Ops::store4(normal + 4, Ops::mul(iy, r10), Ops::mul(iy, r11),
+              Ops::mul(iy, r12), zero);
+  Ops::store4(normal + 8, Ops::mul(iz, r20), Ops::mul(iz, r21),
+              Ops::mul(iz, r22), zero);
+  Ops::store4(normal + 12, zero, zero, zero, one);
+}
+
+template <typename Ops>
+uint32_t computeBatches(const glm::vec3 *translations,
+                        const glm::vec3 *rotations, const glm::vec3 *scales,
+                        uint32_t first, uint32_t count,
+                        ObjectMatrices *matrices) {
+  uint32_t i = first;
+  for (; i + Ops::WIDTH <= count; i += Ops::WIDTH) {
+    computeBatch<Ops>(translations + i, rotations + i, scales + i,
+                      matrices + i);
+  }
+  return i;
+}
+
+} // namespace
+
+void computeObjectMatrices(const glm::vec3 *translations,
+                           const glm::vec3 *rotations, const glm::vec3 *scales,
+                           uint32_t count, ObjectMatrices *matrices) {
+  uint32_t i = 0;
+#ifdef ENGINE_TRANSFORM_AVX2
+  i = computeBatches<Avx2Ops>(translations, rotations, scales, i, count,
+                              matrices);
+#endif
+#ifdef ENGINE_TRANSFORM_SSE2
+  i = computeBatches<Sse2Ops>(translations, rotations, scales, i, count,
+                              matrices);
+#endif
+  computeBatches<ScalarOps>(translations, rotations, scales, i, count,
+                            matrices);
+}
+
+const char *transformKernelName() {
+#if defined(ENGINE_TRANSFORM_AVX2)
+  return "AVX2";
+#elif defined(ENGINE_TRANSFORM_SSE2)
+  return "SSE2";
+#else
+  return "scalar";
+#endif
+}
+
+} // namespace engine
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace engine {
+
+// Model and normal matrix of one object, laid out like ObjectData in
+// simple_shader.vert (std430). Only the upper 3x3 of the normal matrix is
+// used; a std430 mat3 would still take 48 bytes, so storing a mat4 costs 16
+// bytes per object in exchange for the same layout, alignment and kernels
+// as the model matrix.
+struct ObjectMatrices {
+  glm::mat4 modelMatrix{1.f};
+  glm::mat4 normalMatrix{1.f};
+};
+
+// Batched TransformComponent::mat4() and normalMatrix() over component
+// arrays such as Scene's: matrices[i] is computed from translations[i],
+// rotations[i] and scales[i]. The sines and cosines are computed once per
+// object and shared by both matrices.
+//
+// Objects are processed 8 at a time with AVX2 (when built with
+// ENABLE_AVX2), 4 at a time with SSE2, and one at a time otherwise. Results
+// match the per-object functions to within float rounding for rotations
+// within +-8192 radians.
+void computeObjectMatrices(const glm::vec3 *translations,
+                           const glm::vec3 *rotations, const glm::vec3 *scales,
+                           uint32_t count, ObjectMatrices *matrices);
+
+// "AVX2", "SSE2" or "scalar", whichever computeObjectMatrices uses for full
+// batches.
+const char *transformKernelName();
+
+} // namespace engine
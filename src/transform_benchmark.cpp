@@ -0,0 +1,107 @@
+#include "transform_benchmark.hpp"
+#include "benchmark.hpp"
+#include "gameobject.hpp"
+#include "transform_batch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace engine {
+
+namespace {
+
+constexpr uint32_t OBJECT_COUNT = 100'000;
+constexpr int REPEATS = 50;
+constexpr int RUNS = 5;
+// Relative to the element's magnitude, or absolute below 1.
+constexpr float TOLERANCE = 1e-5f;
+
+// Objects per second.
+template <typename Fn> double measure(Fn &&fn) {
+  return OBJECT_COUNT / benchmark::bestOf(RUNS, REPEATS, fn);
+}
+
+float maxError(const glm::mat4 &expected, const glm::mat4 &actual) {
+  float error = 0.f;
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      float e = expected[column][row];
+      float difference = std::abs(actual[column][row] - e);
+      error = std::max(error, difference / std::max(1.f, std::abs(e)));
+    }
+  }
+  return error;
+}
+
+} // namespace
+
+bool runTransformBenchmark() {
+  std::mt19937 random{42};
+  std::uniform_real_distribution<float> translation{-100.f, 100.f};
+  std::uniform_real_distribution<float> rotation{-10.f, 10.f};
+  std::uniform_real_distribution<float> scale{0.1f, 5.f};
+
+  std::vector<glm::vec3> translations(OBJECT_COUNT);
+  std::vector<glm::vec3> rotations(OBJECT_COUNT);
+  std::vector<glm::vec3> scales(OBJECT_COUNT);
+  for (uint32_t i = 0; i < OBJECT_COUNT; i++) {
+    translations[i] = {translation(random), translation(random),
+                       translation(random)};
+    rotations[i] = {rotation(random), rotation(random), rotation(random)};
+    scales[i] = {scale(random), scale(random), scale(random)};
+  }
+
+  std::vector<ObjectMatrices> expected(OBJECT_COUNT);
+  std::vector<ObjectMatrices> batched(OBJECT_COUNT);
+
+  double perObject = measure([&] {
+    for (uint32_t i = 0; i < OBJECT_COUNT; i++) {
+      TransformComponent transform{};
+      transform.translation = translations[i];
+      transform.rotation = rotations[i];
+      transform.scale = scales[i];
+      expected[i].modelMatrix = transform.mat4();
+      expected[i].normalMatrix = transform.normalMatrix();
+    }
+    benchmark::keep(expected.back().modelMatrix[0][0]);
+  });
+  double batch = measure([&] {
+    computeObjectMatrices(translations.data(), rotations.data(),
+                          scales.data(), OBJECT_COUNT, batched.data());
+    benchmark::keep(batched.back().modelMatrix[0][0]);
+  });
+
+  float error = 0.f;
+  for (uint32_t i = 0; i < OBJECT_COUNT; i++) {
+    error = std::max(error, maxError(expected[i].modelMatrix,
+                                     batched[i].modelMatrix));
+    error = std::max(error, maxError(expected[i].normalMatrix,
+                                     batched[i].normalMatrix));
+  }
+
+  std::cout << std::fixed << std::setprecision(1)
+            << "Model + normal matrices per second, " << OBJECT_COUNT
+            << " objects" << std::endl
+            << "  per object: " << perObject / 1e6 << " M" << std::endl
+            << "  batched (" << transformKernelName() << "): " << batch / 1e6
+            << " M, " << batch / perObject << "x" << std::endl
+            << std::scientific << std::setprecision(2)
+            << "  max error: " << error << std::endl;
+
+  if (error > TOLERANCE) {
+    std::cerr << "Batched matrices differ from TransformComponent by more "
+                 "than "
+              << TOLERANCE << std::endl;
+    return false;
+  }
+  return true;
+}
+
+} // namespace engine
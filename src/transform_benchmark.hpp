@@ -0,0 +1,10 @@
+#pragma once
+
+namespace engine {
+
+// Times computing model and normal matrices one TransformComponent at a
+// time against computeObjectMatrices, and checks that both agree. Returns
+// false if they don't. Runs on the CPU only, no device is created.
+bool runTransformBenchmark();
+
+} // namespace engine
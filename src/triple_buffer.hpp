@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace engine {
+
+// Lock-free single producer, single consumer hand-off of the latest value.
+// The producer always has a buffer to write into and the consumer always
+// has a complete value to read; values the consumer never picked up are
+// overwritten.
+template <typename T> class TripleBuffer {
+public:
+  TripleBuffer() = default;
+
+  TripleBuffer(const TripleBuffer &) = delete;
+  TripleBuffer &operator=(const TripleBuffer &) = delete;
+
+  // Producer side. The buffer may hold an older value, so containers can
+  // be reused without reallocating.
+  T &writeBuffer() { return buffers[writeIndex]; }
+  void publish() {
+    writeIndex =
+        state.exchange(writeIndex | DIRTY_BIT, std::memory_order_acq_rel) &
+        INDEX_MASK;
+  }
+
+  // Consumer side. Returns true if a newer value was taken.
+  bool update() {
+    if (!(state.load(std::memory_order_relaxed) & DIRTY_BIT)) {
+      return false;
+    }
+    readIndex =
+        state.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+    return true;
+  }
+  const T &readBuffer() const { return buffers[readIndex]; }
+
+private:
+  static constexpr uint8_t INDEX_MASK = 0x3;
+  static constexpr uint8_t DIRTY_BIT = 0x4;
+
+  std::array<T, 3> buffers{};
+  uint8_t writeIndex = 0;
+  uint8_t readIndex = 1;
+  // Index of the buffer between producer and consumer, plus whether it
+  // holds a value the consumer hasn't taken yet.
+  std::atomic<uint8_t> state{2};
+};
+
+} // namespace engine
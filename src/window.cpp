@@ -17,6 +17,17 @@ Window::~Window() {
 
 bool Window::shouldClose() { return glfwWindowShouldClose(window); }
 
+int Window::getRefreshRate() const {
+  constexpr int DEFAULT_REFRESH_RATE = 60;
+  GLFWmonitor *monitor = glfwGetPrimaryMonitor();
+  const GLFWvidmode *mode =
+      monitor != nullptr ? glfwGetVideoMode(monitor) : nullptr;
+  if (mode == nullptr || mode->refreshRate <= 0) {
+    return DEFAULT_REFRESH_RATE;
+  }
+  return mode->refreshRate;
+}
+
 void Window::createWindowSurface(VkInstance instance, VkSurfaceKHR *surface) {
   if (glfwCreateWindowSurface(instance, window, nullptr, surface) !=
       VK_SUCCESS) {
@@ -23,6 +23,8 @@ public:
   bool wasWindowResized() { return framebufferResized; }
   void resetWindowResizedFlag() { framebufferResized = false; }
   GLFWwindow *getGLFWwindow() const { return window; }
+  // Of the primary monitor, or 60 when unknown.
+  int getRefreshRate() const;
 
   void createWindowSurface(VkInstance instance, VkSurfaceKHR *surface);
 